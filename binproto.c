@@ -0,0 +1,303 @@
+/*
+ *   File:   binproto.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 20:48
+ *
+ *   Framed binary request/response protocol for monitoring hosts. Shares
+ *   the console UART with the text CLI; see binproto.h for the format.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <util/crc16.h>
+
+#include "config.h"
+#include "main.h"
+#include "binproto.h"
+#include "sampler.h"
+#include "timeout.h"
+#include "usart_buffered.h"
+#include "util.h"
+
+#define BINPROTO_MAX_FRAME  64 // Encoded. Requests and responses share the buffer
+
+static uint8_t _g_bin_buf[BINPROTO_MAX_FRAME];
+static uint8_t _g_bin_len;
+static bool _g_bin_overflow;
+static bool _g_bin_active;
+
+static void put_u16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = (uint8_t)(value & 0xFF);
+    buf[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *buf, uint32_t value)
+{
+    put_u16(buf, (uint16_t)(value & 0xFFFF));
+    put_u16(buf + 2, (uint16_t)(value >> 16));
+}
+
+static uint16_t get_u16(const uint8_t *buf)
+{
+    return buf[0] | (uint16_t)buf[1] << 8;
+}
+
+static uint16_t binproto_crc(const uint8_t *buf, uint8_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
+        crc = _crc_xmodem_update(crc, *buf++);
+
+    return crc;
+}
+
+/*
+ * In place. Output never gets ahead of input so this is safe. Returns the
+ * decoded length or -1 if the frame is malformed.
+ */
+static int16_t cobs_decode(uint8_t *buf, uint8_t len)
+{
+    uint8_t in = 0;
+    uint8_t out = 0;
+
+    while (in < len) {
+        uint8_t code = buf[in++];
+        uint8_t i;
+
+        if (!code || in + code - 1 > len)
+            return -1;
+
+        for (i = 1; i < code; i++)
+            buf[out++] = buf[in++];
+
+        if (code != 0xFF && in < len)
+            buf[out++] = 0;
+    }
+
+    return out;
+}
+
+/*
+ * Encodes straight into the TX ring, looking ahead in buf for each block
+ * length, so no second buffer is needed.
+ */
+static void cobs_send(const uint8_t *buf, uint8_t len)
+{
+    uint8_t pos = 0;
+
+    for (;;) {
+        uint8_t run = 0;
+        uint8_t i;
+
+        while (pos + run < len && buf[pos + run] && run < 0xFE)
+            run++;
+
+        console1_put(run + 1);
+
+        for (i = 0; i < run; i++)
+            console1_put(buf[pos + i]);
+
+        pos += run;
+
+        if (pos >= len)
+            break;
+
+        if (run < 0xFE)
+            pos++; // The zero that ended this block
+    }
+
+    console1_put(0x00);
+}
+
+/*
+ * Response payload goes in from _g_bin_buf[2].
+ */
+static void binproto_reply(uint8_t type, uint8_t seq, uint8_t len)
+{
+    uint8_t *buf = _g_bin_buf;
+
+    buf[0] = type;
+    buf[1] = seq;
+    len += 2;
+
+    put_u16(&buf[len], binproto_crc(buf, len));
+    cobs_send(buf, len + 2);
+}
+
+static void binproto_error(uint8_t seq, uint8_t code)
+{
+    _g_bin_buf[2] = code;
+    binproto_reply(BINPROTO_ERROR, seq, 1);
+}
+
+static uint8_t binproto_snapshot(sys_runstate_t *rs, uint8_t *out)
+{
+    uint8_t *p = out;
+    uint8_t i;
+
+    *p++ = rs->psu_num;
+
+    for (i = 0; i < rs->psu_num; i++) {
+        psu_sample_t *sample = &_g_samples[i];
+
+        *p++ = rs->psu_addrs[i];
+        *p++ = sample->flags;
+        put_u16(p, sample->volts);
+        put_u16(p + 2, sample->amps);
+        p += 4;
+    }
+
+    return p - out;
+}
+
+static uint8_t binproto_setpoint(sys_runstate_t *rs, uint8_t *payload, uint8_t len)
+{
+    uint8_t result = BINPROTO_OK;
+
+    if (len == 2) {
+        uint16_t volts = get_u16(payload);
+
+        if (volts < OUTPUT_VOLTAGE_MIN || volts > OUTPUT_VOLTAGE_MAX)
+            result = BINPROTO_ERR_RANGE;
+        else if (!psu_set_output_voltage(rs, volts))
+            result = BINPROTO_ERR_FAILED;
+    } else if (len) {
+        result = BINPROTO_ERR_LENGTH;
+    }
+
+    payload[0] = result;
+    put_u16(&payload[1], rs->config->output_voltage);
+
+    return 3;
+}
+
+static uint8_t binproto_status(sys_runstate_t *rs, uint8_t *out)
+{
+    uint8_t flags = 0;
+
+    if (rs->outvoltage_stale)
+        flags |= BINPROTO_STATUS_STALE;
+    if (rs->config->hitless)
+        flags |= BINPROTO_STATUS_HITLESS;
+
+    out[0] = PS_ON_STATE;
+    out[1] = rs->psu_num;
+    out[2] = flags;
+    put_u16(&out[3], rs->config->output_voltage);
+    put_u32(&out[5], get_uptime());
+
+    return 9;
+}
+
+static void binproto_stop(sys_runstate_t *rs)
+{
+    _g_bin_active = false;
+    console_mute(false);
+    usart1_set_flow_control(rs->config->flow_control);
+}
+
+static void binproto_frame(sys_runstate_t *rs)
+{
+    uint8_t *buf = _g_bin_buf;
+    int16_t len = cobs_decode(buf, _g_bin_len);
+    uint8_t *payload = &buf[2];
+    uint8_t type;
+    uint8_t seq;
+
+    if (len < 4)
+        return; // Not even a header and CRC. Nothing to reply to
+
+    type = buf[0];
+    seq = buf[1];
+    len -= 4;
+
+    if (binproto_crc(buf, len + 2) != get_u16(&buf[len + 2])) {
+        binproto_error(seq, BINPROTO_ERR_CRC);
+        return;
+    }
+
+    switch (type) {
+    case BINPROTO_SNAPSHOT:
+        if (len)
+            break;
+        binproto_reply(type | BINPROTO_RESPONSE, seq, binproto_snapshot(rs, payload));
+        return;
+    case BINPROTO_SETPOINT:
+        binproto_reply(type | BINPROTO_RESPONSE, seq, binproto_setpoint(rs, payload, len));
+        return;
+    case BINPROTO_STATUS:
+        if (len)
+            break;
+        binproto_reply(type | BINPROTO_RESPONSE, seq, binproto_status(rs, payload));
+        return;
+    case BINPROTO_EXIT:
+        binproto_reply(type | BINPROTO_RESPONSE, seq, 0);
+        binproto_stop(rs);
+        return;
+    default:
+        binproto_error(seq, BINPROTO_ERR_TYPE);
+        return;
+    }
+
+    binproto_error(seq, BINPROTO_ERR_LENGTH);
+}
+
+/*
+ * Takes over the console. Text output is muted and flow control is off
+ * until the host sends BINPROTO_EXIT.
+ */
+void binproto_start(void)
+{
+    _g_bin_len = 0;
+    _g_bin_overflow = false;
+    _g_bin_active = true;
+
+    usart1_set_flow_control(false);
+    console_mute(true);
+}
+
+bool binproto_active(void)
+{
+    return _g_bin_active;
+}
+
+void binproto_process(sys_runstate_t *rs)
+{
+    while (_g_bin_active && console1_data_ready()) {
+        uint8_t c = console1_get();
+
+        if (c) {
+            if (_g_bin_len < BINPROTO_MAX_FRAME)
+                _g_bin_buf[_g_bin_len++] = c;
+            else
+                _g_bin_overflow = true; // Dropped when the delimiter turns up
+            continue;
+        }
+
+        if (_g_bin_len && !_g_bin_overflow)
+            binproto_frame(rs);
+
+        _g_bin_len = 0;
+        _g_bin_overflow = false;
+    }
+}
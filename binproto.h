@@ -0,0 +1,56 @@
+/*
+ *   File:   binproto.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 20:48
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BINPROTO_H__
+#define __BINPROTO_H__
+
+/*
+ * Frames are COBS encoded and end with 0x00. Decoded, each one is:
+ *
+ *   type, seq, payload..., crc16 LSB, crc16 MSB
+ *
+ * CRC-16/CCITT-FALSE (0x1021, init 0xFFFF) over type to end of payload.
+ * Responses echo seq and set bit 7 of type. Multi-byte values are little
+ * endian. Hosts should send a lone 0x00 after the 'binary' command to
+ * flush anything left over from the text CLI (e.g. the LF of a CR LF).
+ */
+#define BINPROTO_SNAPSHOT       0x01 // -> psu_num, then per PSU: addr, flags, volts u16, amps u16
+#define BINPROTO_SETPOINT       0x02 // [volts u16] -> result, volts u16. Empty payload only reads
+#define BINPROTO_STATUS         0x03 // -> ps_on, psu_num, flags, output_voltage u16, uptime_s u32
+#define BINPROTO_EXIT           0x7F // -> (empty). Back to the text CLI
+#define BINPROTO_ERROR          0xFF // <- error code
+
+#define BINPROTO_RESPONSE       0x80
+
+#define BINPROTO_OK             0x00
+#define BINPROTO_ERR_CRC        0x01
+#define BINPROTO_ERR_TYPE       0x02
+#define BINPROTO_ERR_LENGTH     0x03
+#define BINPROTO_ERR_RANGE      0x04
+#define BINPROTO_ERR_FAILED     0x05
+
+#define BINPROTO_STATUS_STALE   0x01 // outvoltage not yet applied to the PSUs
+#define BINPROTO_STATUS_HITLESS 0x02
+
+void binproto_start(void);
+bool binproto_active(void);
+void binproto_process(sys_runstate_t *rs);
+
+#endif /* __BINPROTO_H__ */
@@ -35,6 +35,16 @@
 #include "i2c.h"
 #include "lcd.h"
 #include "fnppsu.h"
+#include "sampler.h"
+#include "timeout.h"
+#include "binproto.h"
+#include "modbus.h"
+#include "monitor.h"
+#include "energy.h"
+#include "stats.h"
+#include "perf.h"
+#include "latency.h"
+#include "mem.h"
 
 #define CMD_NONE              0x00
 #define CMD_READLINE          0x01
@@ -74,6 +84,7 @@
 #define PARAM_U8_BIT          2
 #define PARAM_U8_MAXPSU       3
 #define PARAM_U16_2DP_OUTVOLT 4
+#define PARAM_U32_BAUD        5
 
 #define CMD_MAX_CONSOLE       1
 #define CMD_MAX_LINE          64
@@ -97,11 +108,69 @@ static void cmd_process_char(uint8_t c, uint8_t idx);
 static void cmd_prompt(cmd_state_t *ccmd);
 static void cmd_erase_line(cmd_state_t *ccmd);
 static bool do_measure(sys_runstate_t *rs);
+static bool do_inventory(sys_runstate_t *rs, char *arg);
+static bool do_uart(char *arg);
+static bool do_baud(sys_runstate_t *rs, uint32_t baud);
+static bool do_stream(sys_runstate_t *rs, char *arg);
+static bool do_power(sys_runstate_t *rs);
+static bool do_energy(char *arg);
+#ifdef _STATS_
+static bool do_stats(sys_runstate_t *rs, char *arg);
+#endif /* _STATS_ */
+#ifdef _PERF_
+static bool do_perf(char *arg);
+#endif /* _PERF_ */
+static void do_mem(void);
+#ifdef _LATENCY_
+static bool do_latency(sys_runstate_t *rs, char *arg);
+#endif /* _LATENCY_ */
+static void baud_revert(void *param);
 static void do_show(sys_config_t *config);
 static void do_default_config(sys_runstate_t *rs);
 static bool parse_param(void *param, uint8_t type, char *arg);
 
+#ifdef _STATS_
+#define HELP_STATS \
+        "\tstats [reset]\r\n" \
+        "\t\tShow min, max, mean and peak current and voltage of each power\r\n" \
+        "\t\tsupply, recently and since power up. 'reset' clears the recent\r\n" \
+        "\t\tfigures and the peaks\r\n\r\n"
+#else
+#define HELP_STATS ""
+#endif /* _STATS_ */
+
+#ifdef _PERF_
+#define HELP_PERF \
+        "\tperf [reset]\r\n" \
+        "\t\tShow how long the idle loop and power supply calls take\r\n" \
+        "\t\t'reset' clears the timings\r\n\r\n"
+#else
+#define HELP_PERF ""
+#endif /* _PERF_ */
+
+#ifdef _LATENCY_
+#define HELP_LATENCY \
+        "\tlatency [reset]\r\n" \
+        "\t\tShow the longest time in each interrupt and with interrupts off,\r\n" \
+        "\t\tand the fastest baud rate that is safe. 'reset' clears them\r\n\r\n"
+#else
+#define HELP_LATENCY ""
+#endif /* _LATENCY_ */
+
+#ifdef _MODBUS_
+#define HELP_MODBUS \
+        "\tmodbus [1 to %u]\r\n" \
+        "\t\tSwitch this port to Modbus RTU as the given slave address. Kept\r\n" \
+        "\t\tacross resets until 0 is written to holding register 3\r\n\r\n"
+#else
+#define HELP_MODBUS ""
+#endif /* _MODBUS_ */
+
 uint8_t _g_current_console;
+
+static int8_t _g_baud_timer = -1;
+static bool _g_baud_pending;
+static uint32_t _g_baud_prev;
 cmd_state_t _g_cmd[CMD_MAX_CONSOLE];
 
 static void do_help(void)
@@ -121,9 +190,43 @@ static void do_help(void)
         "\texpectedpsus [0 to %u]\r\n"
         "\t\tDo not power up unless N number of power supplies are detected\r\n"
         "\t\tSet to 0 to disable this check\r\n\r\n"
+        "\thitless [0 or 1]\r\n"
+        "\t\tSet to '1' to change the output voltage live in small steps\r\n"
+        "\t\tinstead of switching the output off and on again\r\n\r\n"
         "\tmeasuredvoltage [0 or 1]\r\n"
         "\t\tSet to '1' to show the measured voltage on the LCD instead of\r\n"
         "\t\tconfigured voltage\r\n\r\n"
+        "\tpower\r\n"
+        "\t\tShow the output power of each power supply and in total\r\n\r\n"
+        "\tenergy [reset]\r\n"
+        "\t\tShow the energy delivered, kept across power cycles\r\n"
+        "\t\t'reset' sets it back to zero\r\n\r\n"
+        HELP_STATS
+        HELP_PERF
+        HELP_LATENCY
+        "\tinventory [rescan]\r\n"
+        "\t\tShow identity details of the attached power supplies\r\n"
+        "\t\t'rescan' scans the whole bus and updates the stored list\r\n\r\n"
+        "\tflowcontrol [0 or 1]\r\n"
+        "\t\tSet to '1' to use XON/XOFF flow control on this port\r\n\r\n"
+        "\tbaud [9600 to 921600]\r\n"
+        "\t\tChange the baud rate of this port. Press enter at the new rate\r\n"
+        "\t\twithin %u seconds to keep it\r\n\r\n"
+        "\tstream <%u to %u> [compact or csv]\r\n"
+        "\t\tPrint a timestamped line of readings every N milliseconds until\r\n"
+        "\t\ta key is pressed\r\n\r\n"
+        "\twatch\r\n"
+        "\t\tShow a live table of readings until a key is pressed\r\n\r\n"
+        "\tbinary\r\n"
+        "\t\tSwitch this port to the binary protocol until the host exits it\r\n\r\n"
+        "\tuart [reset]\r\n"
+        "\t\tShow serial port error and flow control counters\r\n\r\n"
+        "\tmem\r\n"
+        "\t\tShow RAM use, and the most stack used since reset\r\n\r\n"
+        "\tsampleinterval [%u to %u]\r\n"
+        "\t\tMilliseconds between current readings of each power supply\r\n"
+        "\t\tVoltage and other readings are taken at multiples of this\r\n\r\n"
+        HELP_MODBUS // Last, so its argument is harmless when left out
         "\tshow\r\n"
         "\t\tShow the persisted configuration\r\n\r\n"
         "\tdefault\r\n"
@@ -132,7 +235,13 @@ static void do_help(void)
         "\t\tReset this board\r\n\r\n",
         fixedpoint_arg_u_2dp(OUTPUT_VOLTAGE_MIN),
         fixedpoint_arg_u_2dp(OUTPUT_VOLTAGE_MAX),
-        MAX_PSU
+        MAX_PSU,
+        BAUD_CONFIRM_MS / 1000,
+        STREAM_INTERVAL_MIN,
+        STREAM_INTERVAL_MAX,
+        SAMPLE_INTERVAL_MIN,
+        SAMPLE_INTERVAL_MAX,
+        MODBUS_ADDR_MAX
     );
 }
 
@@ -179,12 +288,115 @@ static bool command_prompt_handler(sys_runstate_t *rs, char *text)
             save_configuration(rs->config);
         return ret;
     }
+    else if (!stricmp(command, "hitless")) {
+        ret = parse_param(&rs->config->hitless, PARAM_U8_BIT, arg);
+        if (ret)
+            save_configuration(rs->config);
+        return ret;
+    }
+    else if (!stricmp(command, "flowcontrol")) {
+        ret = parse_param(&rs->config->flow_control, PARAM_U8_BIT, arg);
+        if (ret) {
+            save_configuration(rs->config);
+            usart1_set_flow_control(rs->config->flow_control);
+        }
+        return ret;
+    }
+    else if (!stricmp(command, "baud")) {
+        uint32_t baud = 0;
+
+        ret = parse_param(&baud, PARAM_U32_BAUD, arg);
+        if (ret)
+            ret = do_baud(rs, baud);
+        return ret;
+    }
+    else if (!stricmp(command, "stream")) {
+        return do_stream(rs, arg);
+    }
+    else if (!stricmp(command, "watch")) {
+        if (!rs->psu_num) {
+            printf("Error: No power supplies detected\r\n");
+            return false;
+        }
+        return monitor_watch_start(rs);
+    }
+    else if (!stricmp(command, "binary")) {
+        printf("Entering binary mode. Send an exit packet or reset to return\r\n");
+        binproto_start();
+        return true;
+    }
+#ifdef _MODBUS_
+    else if (!stricmp(command, "modbus")) {
+        uint8_t addr = 0;
+
+        ret = parse_param(&addr, PARAM_U8, arg);
+        if (ret && (!addr || addr > MODBUS_ADDR_MAX)) {
+            printf("Error: Out of range\r\n");
+            ret = false;
+        }
+        if (ret) {
+            printf("Switching to Modbus RTU at address %u\r\n", addr);
+            rs->config->modbus_addr = addr;
+            save_configuration(rs->config);
+            ret = modbus_start(rs);
+        }
+        return ret;
+    }
+#endif /* _MODBUS_ */
+#ifdef _BENCHMARK_
+    else if (!stricmp(command, "bench")) {
+        format_benchmark();
+        return true;
+    }
+#endif /* _BENCHMARK_ */
+    else if (!stricmp(command, "power")) {
+        return do_power(rs);
+    }
+    else if (!stricmp(command, "energy")) {
+        return do_energy(arg);
+    }
+#ifdef _STATS_
+    else if (!stricmp(command, "stats")) {
+        return do_stats(rs, arg);
+    }
+#endif /* _STATS_ */
+#ifdef _PERF_
+    else if (!stricmp(command, "perf")) {
+        return do_perf(arg);
+    }
+#endif /* _PERF_ */
+#ifdef _LATENCY_
+    else if (!stricmp(command, "latency")) {
+        return do_latency(rs, arg);
+    }
+#endif /* _LATENCY_ */
+    else if (!stricmp(command, "uart")) {
+        return do_uart(arg);
+    }
+    else if (!stricmp(command, "mem")) {
+        do_mem();
+        return true;
+    }
     else if (!stricmp(command, "measuredvoltage")) {
         ret = parse_param(&rs->config->show_measured_volts, PARAM_U8_BIT, arg);
         if (ret)
             save_configuration(rs->config);
         return ret;
     }
+    else if (!stricmp(command, "sampleinterval")) {
+        uint16_t interval = 0;
+
+        ret = parse_param(&interval, PARAM_U16, arg);
+        if (ret && (interval < SAMPLE_INTERVAL_MIN || interval > SAMPLE_INTERVAL_MAX)) {
+            printf("Error: Out of range\r\n");
+            ret = false;
+        }
+        if (ret) {
+            rs->config->sample_interval = interval;
+            save_configuration(rs->config); // Picked up from the next round
+        }
+        return ret;
+    }
     else if (!stricmp(command, "on")) {
         return psu_change_state(rs, true);
     }
@@ -196,6 +408,9 @@ static bool command_prompt_handler(sys_runstate_t *rs, char *text)
         reset();
         return true;
     }
+    else if (!stricmp(command, "inventory")) {
+        return do_inventory(rs, arg);
+    }
     else if (!stricmp(command, "show")) {
         do_show(rs->config);
         return true;
@@ -221,11 +436,21 @@ static void do_show(sys_config_t *config)
             "\tstartmode ............: %u\r\n"
             "\texpectedpsus .........: %u\r\n"
             "\tmeasuredvoltage ......: %u\r\n"
+            "\thitless ..............: %u\r\n"
+            "\tsampleinterval .......: %u\r\n"
+            "\tflowcontrol ..........: %u\r\n"
+            "\tbaud .................: %lu\r\n"
+            "\tmodbus ...............: %u\r\n"
             "\r\n",
                 fixedpoint_arg_u_2dp(config->output_voltage),
                 config->start_mode,
                 config->expected_psus,
-                config->show_measured_volts
+                config->show_measured_volts,
+                config->hitless,
+                config->sample_interval,
+                config->flow_control,
+                config->baud,
+                config->modbus_addr
             );
 }
 
@@ -240,13 +465,19 @@ static void do_default_config(sys_runstate_t *rs)
         rs->outvoltage_stale = true;
 
     printf("Default configuration loaded\r\n");
+
+    usart1_set_brg(UART1_BRG(rs->config->baud));
+    usart1_set_flow_control(rs->config->flow_control);
 }
 
+// label and unit must be literals
+#define print_measure(label, value, unit) \
+    do { printf(label); print_2dp(value, 0); printf(unit); } while (0)
+
 static bool do_measure(sys_runstate_t *rs)
 {
+    psu_totals_t totals;
     uint8_t i;
-    uint16_t average_voltage = 0;
-    uint16_t total_amps = 0;
 
     if (!PS_ON_STATE) {
         printf("Error: Output is currently switched off\r\n");
@@ -260,34 +491,360 @@ static bool do_measure(sys_runstate_t *rs)
 
     for (i = 0; i < rs->psu_num; i++)
     {
-        uint16_t volts;
-        uint16_t amps;
+        psu_sample_t *sample = &_g_samples[i];
         uint8_t addr = rs->psu_addrs[i];
 
-        if (!fnppsu_output1_read_meas_voltage(addr, &volts)) {
-            printf("Error reading voltage from PSU @ 0x%02X\r\n", addr);
+        if (!(sample->flags & SAMPLE_VALID)) {
+            printf("No measurements yet from PSU @ 0x%02X\r\n", addr);
             continue;
         }
 
-        if (!fnppsu_output1_read_meas_current(addr, &amps)) {
-            printf("Error reading current from PSU @ 0x%02X\r\n", addr);
+        if (sample->flags & SAMPLE_ERROR) {
+            printf("Error reading measurements from PSU @ 0x%02X\r\n", addr);
             continue;
         }
 
-        average_voltage += volts;
-        total_amps += amps;
-
         printf("PSU @ 0x%02X:\r\n", addr);
-        printf("Voltage : %u.%02u V\r\n", fixedpoint_arg_u_2dp(volts));
-        printf("Current : %u.%02u A\r\n\r\n", fixedpoint_arg_u_2dp(amps));
+        print_measure("Voltage : ", sample->volts, " V\r\n");
+        print_measure("Current : ", sample->amps, " A\r\n");
+        print_measure("Power   : ", sampler_watts(sample), " W\r\n");
+        if (sample->have & _BV(FNPPSU_POLL_SET_VOLTAGE))
+            print_measure("Set     : ", sample->set_volts, " V\r\n");
+        if (sample->have & _BV(FNPPSU_POLL_HOURS))
+            printf("Hours   : %lu\r\n", sample->hours);
+        printf("Age     : %lu ms\r\n\r\n", sampler_age_ms(sample));
+    }
+
+    sampler_totals(rs->psu_num, &totals);
+
+    if (!totals.good)
+        return false;
+
+    printf("Total   : Average voltage / Sum of current and power\r\n");
+    print_measure("Voltage : ", totals.avg_volts, " V\r\n");
+    print_measure("Current : ", totals.amps, " A\r\n");
+    print_measure("Power   : ", totals.watts, " W\r\n\r\n");
+
+    return true;
+}
+
+static bool do_power(sys_runstate_t *rs)
+{
+    psu_totals_t totals;
+    uint8_t i;
+
+    if (!PS_ON_STATE) {
+        printf("Error: Output is currently switched off\r\n");
+        return false;
+    }
+
+    if (!rs->psu_num) {
+        printf("Error: No power supplies detected\r\n");
+        return false;
+    }
+
+    for (i = 0; i < rs->psu_num; i++) {
+        psu_sample_t *sample = &_g_samples[i];
+
+        printf("PSU @ 0x%02X : ", rs->psu_addrs[i]);
+
+        if (!(sample->flags & SAMPLE_VALID) || (sample->flags & SAMPLE_ERROR)) {
+            printf("     n/a\r\n");
+            continue;
+        }
+
+        print_2dp(sampler_watts(sample), 8);
+        printf(" W\r\n");
+    }
+
+    sampler_totals(rs->psu_num, &totals);
+
+    printf("Total      : ");
+    print_2dp(totals.watts, 8);
+    printf(" W\r\n");
 
+    return true;
+}
+
+static bool do_energy(char *arg)
+{
+    uint32_t wh;
+    uint8_t hundredths;
+
+    if (arg && !stricmp(arg, "reset")) {
+        energy_reset();
+    } else if (arg) {
+        printf("Error: Invalid argument\r\n");
+        return false;
     }
 
-    average_voltage /= rs->psu_num;
+    wh = energy_get_wh(&hundredths);
 
-    printf("Total   : Average voltage / Sum of current\r\n");
-    printf("Voltage : %u.%02u V\r\n", fixedpoint_arg_u_2dp(average_voltage));
-    printf("Current : %u.%02u A\r\n\r\n", fixedpoint_arg_u_2dp(total_amps));
+    printf("Energy delivered : %lu.%02u Wh\r\n", wh, hundredths);
+    printf("Saved every %u minutes and when the output is switched off\r\n",
+        (uint16_t)(ENERGY_CHECKPOINT_MS / 60000));
+
+    return true;
+}
+
+#ifdef _STATS_
+static void stats_print_series(uint8_t psu, uint8_t series)
+{
+    stats_summary_t sum;
+
+    if (!stats_get(psu, series, &sum)) {
+        printf("  No readings yet\r\n");
+        return;
+    }
+
+    printf("  Window   : ");
+    if (sum.points) {
+        print_2dp(sum.min, 8);
+        print_2dp(sum.max, 9);
+        print_2dp(sum.mean, 9);
+        print_2dp(sum.stddev, 9);
+    } else {
+        printf("      n/a");
+    }
+
+    printf("\r\n  Boot     : ");
+    print_2dp(sum.boot_min, 8);
+    print_2dp(sum.boot_max, 9);
+    print_2dp(sum.boot_mean, 9);
+    printf("         ");
+    print_2dp(sum.peak, 9);
+    printf("\r\n");
+}
+
+static bool do_stats(sys_runstate_t *rs, char *arg)
+{
+    uint8_t i;
+
+    if (arg && !stricmp(arg, "reset")) {
+        stats_reset(false);
+        printf("Window and peak statistics cleared\r\n");
+        return true;
+    } else if (arg) {
+        printf("Error: Invalid argument\r\n");
+        return false;
+    }
+
+    if (!rs->psu_num) {
+        printf("Error: No power supplies detected\r\n");
+        return false;
+    }
+
+    printf("Window is the last %u s, in steps of %u s. Boot is since power up\r\n",
+        (uint16_t)(STATS_WINDOW * (STATS_PERIOD_MS / 1000)), (uint16_t)(STATS_PERIOD_MS / 1000));
+    printf("Peak is the highest single reading since power up or 'stats reset'\r\n");
+
+    if (rs->psu_num > STATS_PSUS)
+        printf("Only the first %u of %u power supplies are tracked (STATS_PSUS)\r\n",
+            STATS_PSUS, rs->psu_num);
+
+    printf("\r\n");
+    printf("                  Min      Max     Mean   StdDev     Peak\r\n");
+
+    for (i = 0; i < rs->psu_num; i++) {
+        uint8_t addr = rs->psu_addrs[i];
+
+        if (i >= STATS_PSUS) {
+            printf("PSU @ 0x%02X: Not tracked. Only the first %u are\r\n", addr, STATS_PSUS);
+            continue;
+        }
+
+        printf("PSU @ 0x%02X current (A)\r\n", addr);
+        stats_print_series(i, STATS_AMPS);
+        printf("PSU @ 0x%02X voltage (V)\r\n", addr);
+        stats_print_series(i, STATS_VOLTS);
+    }
+
+    return true;
+}
+#endif /* _STATS_ */
+
+#ifdef _PERF_
+static bool do_perf(char *arg)
+{
+    if (arg && !stricmp(arg, "reset")) {
+        perf_reset();
+        printf("Timings cleared\r\n");
+        return true;
+    } else if (arg) {
+        printf("Error: Invalid argument\r\n");
+        return false;
+    }
+
+    perf_report();
+
+    return true;
+}
+#endif /* _PERF_ */
+
+static void do_mem(void)
+{
+    mem_usage_t mem;
+
+    mem_usage(&mem);
+
+    printf("Statics      : %u bytes data, %u bss. 'make size' splits them by file\r\n", mem.data, mem.bss);
+    printf("Free         : %u bytes between the statics and the stack\r\n", mem.free);
+    printf("Stack        : %u bytes now, %u at most\r\n", mem.stack, mem.stack_max);
+    printf("Lowest SP    : 0x%04X\r\n", mem.sp_min);
+    printf("Never used   : %u bytes\r\n", mem.untouched);
+}
+
+#ifdef _LATENCY_
+static bool do_latency(sys_runstate_t *rs, char *arg)
+{
+    if (arg && !stricmp(arg, "reset")) {
+        latency_reset();
+        printf("Latency figures cleared\r\n");
+        return true;
+    } else if (arg) {
+        printf("Error: Invalid argument\r\n");
+        return false;
+    }
+
+    latency_report(rs->config->baud);
+
+    return true;
+}
+#endif /* _LATENCY_ */
+
+static bool do_uart(char *arg)
+{
+    usart_stats_t stats;
+
+    if (arg && !stricmp(arg, "reset")) {
+        usart1_clear_stats();
+        return true;
+    } else if (arg) {
+        printf("Error: Invalid argument\r\n");
+        return false;
+    }
+
+    usart1_get_stats(&stats);
+
+    printf("RX overflows : %u\r\n", stats.rx_overflows);
+    printf("RX overruns  : %u\r\n", stats.rx_overruns);
+    printf("RX framing   : %u\r\n", stats.rx_framing);
+    printf("TX dropped   : %u\r\n", console_get_dropped());
+    printf("XOFF sent    : %s\r\n", stats.rx_stopped ? "Yes" : "No");
+    printf("XOFF held    : %s\r\n", stats.tx_stopped ? "Yes" : "No");
+
+    return true;
+}
+
+static bool do_stream(sys_runstate_t *rs, char *arg)
+{
+    uint16_t interval = 0;
+    uint8_t format = STREAM_COMPACT;
+    char *fmt = NULL;
+
+    if (arg) {
+        arg = strtok(arg, " ");
+        fmt = strtok(NULL, " ");
+    }
+
+    if (!parse_param(&interval, PARAM_U16, arg))
+        return false;
+
+    if (interval < STREAM_INTERVAL_MIN || interval > STREAM_INTERVAL_MAX) {
+        printf("Error: Out of range\r\n");
+        return false;
+    }
+
+    if (fmt && !stricmp(fmt, "csv")) {
+        format = STREAM_CSV;
+    } else if (fmt && stricmp(fmt, "compact")) {
+        printf("Error: Unknown format (%s)\r\n", fmt);
+        return false;
+    }
+
+    if (!rs->psu_num) {
+        printf("Error: No power supplies detected\r\n");
+        return false;
+    }
+
+    return monitor_stream_start(rs, interval, format);
+}
+
+/*
+ * Switches straight away but only saves once a line has been entered at
+ * the new rate (see cmd_process()). Otherwise baud_revert() goes back.
+ */
+static bool do_baud(sys_runstate_t *rs, uint32_t baud)
+{
+    if (_g_baud_timer < 0) {
+        _g_baud_timer = timeout_create(BAUD_CONFIRM_MS, false, false, &baud_revert, (void *)rs);
+        if (_g_baud_timer < 0)
+            return false;
+    }
+
+    if (!_g_baud_pending)
+        _g_baud_prev = rs->config->baud;
+
+    printf("Switching to %lu baud. Press enter within %u seconds to keep it\r\n", baud, BAUD_CONFIRM_MS / 1000);
+
+    rs->config->baud = baud;
+    usart1_set_brg(UART1_BRG(baud));
+
+    _g_baud_pending = true;
+    timeout_start(_g_baud_timer);
+
+    return true;
+}
+
+static void baud_revert(void *param)
+{
+    sys_runstate_t *rs = (sys_runstate_t *)param;
+
+    _g_baud_pending = false;
+    rs->config->baud = _g_baud_prev;
+    usart1_set_brg(UART1_BRG(_g_baud_prev));
+
+    _g_current_console = CONSOLE_1;
+    printf("\r\nBaud rate not confirmed. Back to %lu\r\n", _g_baud_prev);
+    _g_cmd[CONSOLE_1].state = CMD_NONE; // Whatever was typed came in at the wrong rate
+}
+
+static bool do_inventory(sys_runstate_t *rs, char *arg)
+{
+    uint8_t i;
+
+    if (arg && !stricmp(arg, "rescan")) {
+        if (!PS_ON_STATE) {
+            printf("Error: Output is currently switched off\r\n");
+            return false;
+        }
+        return psu_rescan(rs);
+    }
+
+    if (!rs->psu_num) {
+        printf("Error: No power supplies detected\r\n");
+        return false;
+    }
+
+    printf("\r\n");
+
+    for (i = 0; i < rs->psu_num; i++) {
+        fnppsu_dev_info_t info;
+        uint8_t addr = rs->psu_addrs[i];
+
+        if (!fnppsu_get_dev_info(addr, &info)) {
+            printf("Error reading identity from PSU @ 0x%02X\r\n\r\n", addr);
+            continue;
+        }
+
+        printf("PSU @ 0x%02X\r\n", addr);
+        printf("Manufacturer     : %s\r\n", info.mfg);
+        printf("Model            : %s\r\n", info.model);
+        printf("Serial           : %s\r\n", info.serial);
+        printf("Rev              : %s\r\n", info.rev);
+        printf("Mfg. Date        : %u.%u.%u\r\n", info.mfg_year, info.mfg_month, info.mfg_day);
+        printf("Hours in service : %lu\r\n\r\n", info.hours_in_service);
+    }
 
     return true;
 }
@@ -320,6 +877,15 @@ static bool parse_param(void *param, uint8_t type, char *arg)
             return false;
         *(uint8_t *)param = u8param;
         break;
+    case PARAM_U32_BAUD:
+        if (*arg == '-')
+            return false;
+        if (!uart_baud_valid(strtoul(arg, NULL, 10))) {
+            printf("Error: Unsupported baud rate\r\n");
+            return false;
+        }
+        *(uint32_t *)param = strtoul(arg, NULL, 10);
+        break;
     case PARAM_U16:
     case PARAM_U16_2DP_OUTVOLT:
         // Note to self: All this arse about face dealing with fixed point integers
@@ -408,12 +974,48 @@ void cmd_init(void)
     _g_current_console = CONSOLE_1;
 }
 
+static bool cmd_reading(cmd_state_t *ccmd)
+{
+    return (ccmd->state == CMD_READLINE || ccmd->state == CMD_ESCAPE || ccmd->state == CMD_AWAIT_NAV ||
+        ccmd->state == CMD_DEL || ccmd->state == CMD_DROP_NAV);
+}
+
 void cmd_process(sys_runstate_t *rs)
 {
     uint8_t idx, i;
 
+    if (binproto_active()) {
+        binproto_process(rs);
+        if (!binproto_active())
+            _g_cmd[CONSOLE_1].state = CMD_NONE; // Fresh prompt on the way back
+        return;
+    }
+
+    if (monitor_active()) {
+        if (console1_data_ready()) {
+            char c = console1_get();
+
+            // Any key but the tail end of the CR LF that started it
+            if (c != '\n' && c != 0x00) {
+                monitor_stop();
+                _g_cmd[CONSOLE_1].state = CMD_NONE;
+            }
+        }
+        return;
+    }
+
+#ifdef _MODBUS_
+    if (modbus_active()) {
+        modbus_process(rs);
+        _g_cmd[CONSOLE_1].state = CMD_NONE; // Fresh prompt once Modbus lets go
+        return;
+    }
+#endif /* _MODBUS_ */
+
+    // Leave the rest of a paste in the RX ring until this line is done,
+    // so flow control can hold the host off while it runs
 #ifdef _CONSOLE1_
-    while (console1_data_ready())
+    while (cmd_reading(&_g_cmd[CONSOLE_1]) && console1_data_ready())
     {
         char c = console1_get();
         cmd_process_char(c, CONSOLE_1);
@@ -421,7 +1023,7 @@ void cmd_process(sys_runstate_t *rs)
 #endif /* _CONSOLE1_ */
 
 #ifdef _CONSOLE2_
-    while (console2_data_ready())
+    while (cmd_reading(&_g_cmd[CONSOLE_2]) && console2_data_ready())
     {
         char c = console2_get();
         cmd_process_char(c, CONSOLE_2);
@@ -487,6 +1089,14 @@ void cmd_process(sys_runstate_t *rs)
         else if (ccmd->state == CMD_COMPLETE) {
             ccmd->cmd_buf[ccmd->count] = 0;
             printf("\r\n");
+
+            if (_g_baud_pending) {
+                // Got a whole line at the new rate so it must be working
+                timeout_stop(_g_baud_timer);
+                _g_baud_pending = false;
+                save_configuration(rs->config);
+                printf("Baud rate saved\r\n");
+            }
             
             if (ccmd->count > 0) {
                 int8_t tostore = -1;
@@ -524,8 +1134,11 @@ void cmd_process(sys_runstate_t *rs)
                 if (!ret)
                     printf("Error: Command failed\r\n");
             }
-            
-            cmd_prompt(ccmd);
+
+            if (monitor_active())
+                ccmd->state = CMD_NONE; // Prompt comes back when it stops
+            else
+                cmd_prompt(ccmd);
         }
         else if (ccmd->state == CMD_CANCEL)
         {
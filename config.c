@@ -24,11 +24,19 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stddef.h>
 #include <avr/pgmspace.h>
 
 #include "config.h"
+#include "main.h"
+#include "modbus.h"
 #include "util.h"
 
+#define CONFIG_EEPROM_ADDR      0x000
+#define INVENTORY_EEPROM_ADDR   0x100
+#define ENERGY_EEPROM_ADDR      0x200
+#define ENERGY_EEPROM_COPIES    8
+
 void load_configuration(sys_config_t *config)
 {
     uint16_t config_size = sizeof(sys_config_t);
@@ -37,13 +45,25 @@ void load_configuration(sys_config_t *config)
         reset();
     }
     
-    eeprom_read_data(0, (uint8_t *)config, sizeof(sys_config_t));
+    eeprom_read_data(CONFIG_EEPROM_ADDR, (uint8_t *)config, sizeof(sys_config_t));
 
     if (config->magic != CONFIG_MAGIC) {
         printf("\r\nNo configuration found. Setting defaults\r\n");
         default_configuration(config);
         save_configuration(config);
     }
+
+    // Fields added after the first release read back as erased EEPROM
+    if (config->hitless > 1)
+        config->hitless = 0;
+    if (config->sample_interval < SAMPLE_INTERVAL_MIN || config->sample_interval > SAMPLE_INTERVAL_MAX)
+        config->sample_interval = SAMPLE_INTERVAL_DEFAULT;
+    if (config->flow_control > 1)
+        config->flow_control = 1;
+    if (!uart_baud_valid(config->baud))
+        config->baud = UART1_BAUD;
+    if (config->modbus_addr > MODBUS_ADDR_MAX)
+        config->modbus_addr = 0;
 }
 
 void default_configuration(sys_config_t *config)
@@ -53,9 +73,91 @@ void default_configuration(sys_config_t *config)
     config->start_mode = 1;
     config->show_measured_volts = 0;
     config->expected_psus = 0;
+    config->hitless = 0;
+    config->sample_interval = SAMPLE_INTERVAL_DEFAULT;
+    config->flow_control = 1;
+    config->baud = UART1_BAUD;
+    config->modbus_addr = 0;
 }
 
 void save_configuration(sys_config_t *config)
 {
-    eeprom_write_data(0, (uint8_t *)config, sizeof(sys_config_t));
+    eeprom_write_data(CONFIG_EEPROM_ADDR, (uint8_t *)config, sizeof(sys_config_t));
+}
+
+/*
+ * The inventory is read and written a PSU at a time, so the discovery
+ * task needn't hold all of it in RAM between steps.
+ */
+bool load_inventory_count(uint8_t *psu_num)
+{
+    uint16_t magic;
+
+    eeprom_read_data(INVENTORY_EEPROM_ADDR + offsetof(sys_inventory_t, magic), (uint8_t *)&magic, sizeof(magic));
+    eeprom_read_data(INVENTORY_EEPROM_ADDR + offsetof(sys_inventory_t, psu_num), psu_num, sizeof(uint8_t));
+
+    return (magic == INVENTORY_MAGIC && *psu_num <= MAX_PSU);
+}
+
+void save_inventory_count(uint8_t psu_num)
+{
+    uint16_t magic = INVENTORY_MAGIC;
+
+    eeprom_write_data(INVENTORY_EEPROM_ADDR + offsetof(sys_inventory_t, magic), (uint8_t *)&magic, sizeof(magic));
+    eeprom_write_data(INVENTORY_EEPROM_ADDR + offsetof(sys_inventory_t, psu_num), &psu_num, sizeof(uint8_t));
+}
+
+/*
+ * serial is FNPPSU_MAX_SERIAL chars, not null terminated.
+ */
+void load_inventory_psu(uint8_t idx, uint8_t *addr, char *serial)
+{
+    eeprom_read_data(INVENTORY_EEPROM_ADDR + offsetof(sys_inventory_t, addrs) + idx, addr, sizeof(uint8_t));
+    eeprom_read_data(INVENTORY_EEPROM_ADDR + offsetof(sys_inventory_t, serials) + idx * FNPPSU_MAX_SERIAL,
+        (uint8_t *)serial, FNPPSU_MAX_SERIAL);
+}
+
+void save_inventory_psu(uint8_t idx, uint8_t addr, const char *serial)
+{
+    eeprom_write_data(INVENTORY_EEPROM_ADDR + offsetof(sys_inventory_t, addrs) + idx, &addr, sizeof(uint8_t));
+    eeprom_write_data(INVENTORY_EEPROM_ADDR + offsetof(sys_inventory_t, serials) + idx * FNPPSU_MAX_SERIAL,
+        (uint8_t *)serial, FNPPSU_MAX_SERIAL);
+}
+
+/*
+ * Latest of the copies, or false if none were ever saved.
+ */
+bool load_energy(sys_energy_t *energy)
+{
+    sys_energy_t copy;
+    bool found = false;
+    uint8_t i;
+
+    for (i = 0; i < ENERGY_EEPROM_COPIES; i++) {
+        eeprom_read_data(ENERGY_EEPROM_ADDR + i * sizeof(sys_energy_t), (uint8_t *)&copy, sizeof(sys_energy_t));
+
+        if (copy.magic != ENERGY_MAGIC)
+            continue;
+
+        // Compared as a difference so it still works after seq wraps
+        if (!found || (int16_t)(copy.seq - energy->seq) > 0) {
+            memcpy(energy, &copy, sizeof(sys_energy_t));
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Goes over the copy after the latest, so each copy gets one write in
+ * ENERGY_EEPROM_COPIES.
+ */
+void save_energy(sys_energy_t *energy)
+{
+    energy->magic = ENERGY_MAGIC;
+    energy->seq++;
+
+    eeprom_write_data(ENERGY_EEPROM_ADDR + (energy->seq % ENERGY_EEPROM_COPIES) * sizeof(sys_energy_t),
+        (uint8_t *)energy, sizeof(sys_energy_t));
 }
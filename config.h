@@ -21,18 +21,54 @@
 #ifndef __CONFIG_H__
 #define __CONFIG_H__
 
+#include "fnppsu.h"
+
 typedef struct {
     uint16_t magic;
     uint16_t output_voltage;
     uint8_t start_mode;
     uint8_t expected_psus;
     uint8_t show_measured_volts;
+    uint8_t hitless;
+    uint16_t sample_interval;
+    uint8_t flow_control;
+    uint32_t baud;
+    uint8_t modbus_addr;    // Non-zero starts the port in Modbus RTU mode
 } sys_config_t;
 
+/*
+ * Power supplies found by the last full bus scan. Lets boot verify the
+ * known addresses instead of scanning all of them. Only the layout is
+ * used; it's accessed a field at a time.
+ */
+typedef struct {
+    uint16_t magic;
+    uint8_t psu_num;
+    uint8_t addrs[MAX_PSU];
+    char serials[MAX_PSU][FNPPSU_MAX_SERIAL]; // Not null terminated
+} sys_inventory_t;
+
+/*
+ * Energy counter checkpoint. Kept in several copies written in turn, as
+ * it's saved far more often than the rest.
+ */
+typedef struct {
+    uint16_t magic;
+    uint16_t seq;       // The copy with the highest is the latest
+    uint32_t wh;
+    uint32_t part;      // Towards the next Wh, in hundredths of a watt for a millisecond
+} sys_energy_t;
+
 void configuration_bootprompt(sys_config_t *config);
 void load_configuration(sys_config_t *config);
 void save_configuration(sys_config_t *config);
 void default_configuration(sys_config_t *config);
+bool load_inventory_count(uint8_t *psu_num);
+void save_inventory_count(uint8_t psu_num);
+void load_inventory_psu(uint8_t idx, uint8_t *addr, char *serial);
+void save_inventory_psu(uint8_t idx, uint8_t addr, const char *serial);
+bool load_energy(sys_energy_t *energy);
+void save_energy(sys_energy_t *energy);
 int8_t configuration_prompt_handler(char *message, sys_config_t *config, bool sms);
 
 #endif /* __CONFIG_H__ */
\ No newline at end of file
@@ -0,0 +1,112 @@
+/*
+ *   File:   energy.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 20:58
+ *
+ *   Output energy counter. Integrates total output power every sampler
+ *   slot and checkpoints to EEPROM so it survives a power cycle.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "config.h"
+#include "energy.h"
+#include "timeout.h"
+#include "util.h"
+
+#define ENERGY_PART_PER_WH      360000000UL // Hundredths of a watt for a millisecond
+#define ENERGY_MAX_STEP_MS      1000 // Readings any older say little about the gap
+
+static sys_energy_t _g_energy;
+static uint32_t _g_energy_tick;
+static bool _g_energy_dirty;
+
+static void energy_checkpoint_timer(void *param)
+{
+    energy_checkpoint();
+}
+
+void energy_init(void)
+{
+    if (!load_energy(&_g_energy))
+        memset(&_g_energy, 0, sizeof(sys_energy_t));
+
+    _g_energy_tick = get_tick_count();
+    _g_energy_dirty = false;
+
+    timeout_create(ENERGY_CHECKPOINT_MS, true, true, &energy_checkpoint_timer, NULL);
+}
+
+/*
+ * Adds watts (hundredths) over the time since the last call. Anything
+ * lost between checkpoints is at most ENERGY_CHECKPOINT_MS worth.
+ */
+void energy_integrate(uint32_t watts)
+{
+    uint32_t now = get_tick_count();
+    uint32_t ms = (now - _g_energy_tick) * TIMEOUT_MS_PER_TICK;
+
+    _g_energy_tick = now;
+
+    if (!watts)
+        return;
+
+    if (ms > ENERGY_MAX_STEP_MS)
+        ms = ENERGY_MAX_STEP_MS;
+
+    // Can't overflow: 8 kW is 800000 hundredths, for at most a second
+    _g_energy.part += watts * ms;
+
+    while (_g_energy.part >= ENERGY_PART_PER_WH) {
+        _g_energy.part -= ENERGY_PART_PER_WH;
+        _g_energy.wh++;
+    }
+
+    _g_energy_dirty = true;
+}
+
+void energy_checkpoint(void)
+{
+    if (!_g_energy_dirty)
+        return;
+
+    save_energy(&_g_energy);
+    _g_energy_dirty = false;
+}
+
+void energy_reset(void)
+{
+    _g_energy.wh = 0;
+    _g_energy.part = 0;
+
+    save_energy(&_g_energy);
+    _g_energy_dirty = false;
+}
+
+/*
+ * Whole watt-hours, with the hundredths through the pointer.
+ */
+uint32_t energy_get_wh(uint8_t *hundredths)
+{
+    *hundredths = _g_energy.part / (ENERGY_PART_PER_WH / 100);
+    return _g_energy.wh;
+}
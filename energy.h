@@ -0,0 +1,32 @@
+/*
+ *   File:   energy.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 20:58
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ENERGY_H__
+#define __ENERGY_H__
+
+#define ENERGY_CHECKPOINT_MS    900000 // 15 minutes. With the copies, decades of EEPROM life
+
+void energy_init(void);
+void energy_integrate(uint32_t watts);
+void energy_checkpoint(void);
+void energy_reset(void);
+uint32_t energy_get_wh(uint8_t *hundredths);
+
+#endif /* __ENERGY_H__ */
@@ -23,10 +23,14 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
-#include <util/delay.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
 
 #include "fnppsu.h"
 #include "i2c.h"
+#include "timeout.h"
+#include "perf.h"
 
 #define PSU_MODEL_LEN               0x00
 #define PSU_MODEL                   0x01
@@ -53,167 +57,390 @@
 #define OUTPUT1_SET_VOLTAGE_LSB     0xA4
 #define OUTPUT1_SET_VOLTAGE_SCALE   0xA5
 
+#define SET_VOLTAGE_WRITE_DELAY_MS  8
+
+#define FLEET_IDLE                  0
+#define FLEET_WRITE_SECOND          1
+#define FLEET_VERIFY                2
+
 #define psu_pow(value, exp) (exp == 0 ? (value / 10) : (exp == 1 ? value : (exp == 2 ? (value * 10) : value * 100)))
 #define swap_32(x) (((x) >> 24) | (((x) & 0x00FF0000) >> 8) | (((x) & 0x0000FF00) << 8) | ((x) << 24))
 
-bool fnppsu_get_dev_info(uint8_t addr, fnppsu_dev_info_t *info)
+static bool fnppsu_read_string(uint8_t addr, uint8_t len_reg, uint8_t str_reg, char *str, uint8_t max_len)
 {
-    uint8_t i;
     uint8_t str_len;
-    uint8_t tmp;
-    
-    /* Model */
-    if (!i2c_read(addr, PSU_MODEL, &str_len))
-        return false;
-    
-    str_len = str_len > FNPPSU_MAX_MODEL ? FNPPSU_MAX_MODEL : str_len;
 
-    for (i = 0; i < str_len; i++)
-    {
-        if (!i2c_read(addr, PSU_MODEL + i, (uint8_t *)&info->model[i]))
-            return false;
-    }
+    if (!i2c_read(addr, len_reg, &str_len))
+        return false;
 
-    info->model[i] = 0;
+    str_len = str_len > max_len ? max_len : str_len;
 
-    /* Serial */
-    if (!i2c_read(addr, PSU_SERIAL_LEN, &str_len))
+    // Whole string in one sequential read
+    if (str_len && !i2c_read_buf(addr, str_reg, (uint8_t *)str, str_len))
         return false;
 
-    str_len = str_len > FNPPSU_MAX_SERIAL ? FNPPSU_MAX_SERIAL : str_len;
+    str[str_len] = 0;
+    return true;
+}
 
-    for (i = 0; i < str_len; i++)
-    {
-        if (!i2c_read(addr, PSU_SERIAL + i, (uint8_t *)&info->serial[i]))
-            return false;
-    }
+bool fnppsu_get_dev_info(uint8_t addr, fnppsu_dev_info_t *info)
+{
+    uint8_t date[3];
+    PERF_SCOPE(PERF_PSU_INFO);
 
-    info->serial[i] = 0;
+    if (!fnppsu_read_string(addr, PSU_MODEL_LEN, PSU_MODEL, info->model, FNPPSU_MAX_MODEL))
+        return false;
+    if (!fnppsu_read_string(addr, PSU_SERIAL_LEN, PSU_SERIAL, info->serial, FNPPSU_MAX_SERIAL))
+        return false;
+    if (!fnppsu_read_string(addr, PSU_REV_LEN, PSU_REV, info->rev, FNPPSU_MAX_REV))
+        return false;
+    if (!fnppsu_read_string(addr, PSU_MFG_NAME_LEN, PSU_MFG_NAME, info->mfg, FNPPSU_MAX_MFG))
+        return false;
 
-    /* Rev */
-    if (!i2c_read(addr, PSU_REV_LEN, &str_len))
+    /* Year, month, day */
+    if (!i2c_read_buf(addr, PSU_MFG_YEAR, date, sizeof(date)))
         return false;
 
-    str_len = str_len > FNPPSU_MAX_REV ? FNPPSU_MAX_REV : str_len;
+    info->mfg_year = date[0] + 2000;
+    info->mfg_month = date[1];
+    info->mfg_day = date[2];
 
-    for (i = 0; i < str_len; i++)
-    {
-        if (!i2c_read(addr, PSU_REV + i, (uint8_t *)&info->rev[i]))
-            return false;
-    }
+    if (!i2c_read_buf(addr, PSU_HOURS_IN_SERVICE, (uint8_t *)&info->hours_in_service, 4))
+        return false;
 
-    info->rev[i] = 0;
+    info->hours_in_service = swap_32(info->hours_in_service);
+    
+    return true;
+}
 
-    /* Mfg */
-    if (!i2c_read(addr, PSU_MFG_NAME_LEN, &str_len))
-        return false;
+/*
+ * Scale registers never change for a given unit, so they're read once at
+ * discovery rather than alongside every value. An entry is dropped on any
+ * I2C error with that PSU and the whole lot on a re-probe.
+ */
+typedef struct {
+    uint8_t addr;       // 0 = unused
+    uint8_t scales[FNPPSU_POLL_SCALED];
+} fnppsu_cache_t;
+
+static fnppsu_cache_t _g_fnppsu_cache[MAX_PSU];
+
+/*
+ * What the background sampler reads and how often. Current moves with the
+ * load so it's polled the most; the set voltage only changes when we change
+ * it and the hour counter barely moves at all.
+ */
+static const fnppsu_poll_group_t _g_fnppsu_poll_groups[FNPPSU_POLL_GROUPS] PROGMEM = {
+    [FNPPSU_POLL_CURRENT]     = { OUTPUT1_MEAS_CURRENT_MSB, 2, 1,   0 },
+    [FNPPSU_POLL_VOLTAGE]     = { OUTPUT1_MEAS_VOLTAGE_MSB, 2, 4,   1 },
+    [FNPPSU_POLL_SET_VOLTAGE] = { OUTPUT1_SET_VOLTAGE_MSB,  2, 20,  2 },
+    [FNPPSU_POLL_HOURS]       = { PSU_HOURS_IN_SERVICE,     4, 240, 3 },
+};
+
+void fnppsu_poll_group(uint8_t group, fnppsu_poll_group_t *info)
+{
+    memcpy_P(info, &_g_fnppsu_poll_groups[group], sizeof(fnppsu_poll_group_t));
+}
 
-    str_len = str_len > FNPPSU_MAX_MFG ? FNPPSU_MAX_MFG : str_len;
+static fnppsu_cache_t *fnppsu_cache_get(uint8_t addr)
+{
+    uint8_t i;
 
-    for (i = 0; i < str_len; i++)
-    {
-        if (!i2c_read(addr, PSU_MFG_NAME + i, (uint8_t *)&info->mfg[i]))
-            return false;
+    for (i = 0; i < MAX_PSU; i++) {
+        if (_g_fnppsu_cache[i].addr == addr)
+            return &_g_fnppsu_cache[i];
     }
 
-    info->mfg[i] = 0;
+    return NULL;
+}
 
-    if (!i2c_read(addr, PSU_MFG_YEAR, &tmp))
-        return false;
-    if (!i2c_read(addr, PSU_MFG_MONTH, &info->mfg_month))
-        return false;
-    if (!i2c_read(addr, PSU_MFG_DAY, &info->mfg_day))
-        return false;
+static void fnppsu_cache_invalidate(uint8_t addr)
+{
+    fnppsu_cache_t *cache = fnppsu_cache_get(addr);
 
-    info->mfg_year = tmp + 2000;
+    if (cache)
+        cache->addr = 0;
+}
 
-    if (!i2c_read_buf(addr, PSU_HOURS_IN_SERVICE, (uint8_t *)&info->hours_in_service, 4))
-        return false;
+void fnppsu_cache_clear(void)
+{
+    memset(_g_fnppsu_cache, 0, sizeof(_g_fnppsu_cache));
+}
 
-    info->hours_in_service = swap_32(info->hours_in_service);
-    
+bool fnppsu_cache_fill(uint8_t addr)
+{
+    fnppsu_cache_t *cache = fnppsu_cache_get(addr);
+    fnppsu_poll_group_t info;
+    uint8_t i;
+    PERF_SCOPE(PERF_PSU_CACHE);
+
+    if (!cache)
+        cache = fnppsu_cache_get(0);
+
+    if (!cache)
+        return false; // Full
+
+    cache->addr = 0;
+
+    // Each scale register follows its value
+    for (i = 0; i < FNPPSU_POLL_SCALED; i++) {
+        fnppsu_poll_group(i, &info);
+        if (!i2c_read(addr, info.reg + info.len, &cache->scales[i]))
+            return false;
+    }
+
+    cache->addr = addr;
     return true;
 }
 
-bool fnppsu_output1_read_meas_voltage(uint8_t addr, uint16_t *result)
+bool fnppsu_get_serial(uint8_t addr, char *serial)
 {
-    uint8_t msb;
-    uint8_t lsb;
-    uint8_t scale;
+    PERF_SCOPE(PERF_PSU_SERIAL);
 
-    if (!i2c_read(addr, OUTPUT1_MEAS_VOLTAGE_MSB, &msb))
-        return false;
-    if (!i2c_read(addr, OUTPUT1_MEAS_VOLTAGE_LSB, &lsb))
-        return false;
-    if (!i2c_read(addr, OUTPUT1_MEAS_VOLTAGE_SCALE, &scale))
-        return false;
+    return fnppsu_read_string(addr, PSU_SERIAL_LEN, PSU_SERIAL, serial, FNPPSU_MAX_SERIAL);
+}
 
-    *result = psu_pow((uint16_t)(msb << 8 | lsb), scale);
-    return true;
+#define TELEM_OFFSET(reg) ((reg) - OUTPUT1_MEAS_VOLTAGE_MSB)
+
+/*
+ * With the scales cached the read can stop one byte short, before the
+ * current scale.
+ */
+static uint8_t fnppsu_telemetry_len(fnppsu_cache_t *cache)
+{
+    return cache ? FNPPSU_TELEMETRY_LEN - 1 : FNPPSU_TELEMETRY_LEN;
 }
 
-bool fnppsu_output1_read_meas_current(uint8_t addr, uint16_t *result)
+static void fnppsu_decode_telemetry(const uint8_t *raw, fnppsu_cache_t *cache, fnppsu_telemetry_t *telem)
 {
-    uint8_t msb;
-    uint8_t lsb;
-    uint8_t scale;
+    if (cache) {
+        telem->volts_scale = cache->scales[FNPPSU_POLL_VOLTAGE];
+        telem->amps_scale = cache->scales[FNPPSU_POLL_CURRENT];
+    } else {
+        telem->volts_scale = raw[TELEM_OFFSET(OUTPUT1_MEAS_VOLTAGE_SCALE)];
+        telem->amps_scale = raw[TELEM_OFFSET(OUTPUT1_MEAS_CURRENT_SCALE)];
+    }
 
-    if (!i2c_read(addr, OUTPUT1_MEAS_CURRENT_MSB, &msb))
-        return false;
-    if (!i2c_read(addr, OUTPUT1_MEAS_CURRENT_LSB, &lsb))
-        return false;
-    if (!i2c_read(addr, OUTPUT1_MEAS_CURRENT_SCALE, &scale))
+    telem->volts = psu_pow((uint16_t)(raw[TELEM_OFFSET(OUTPUT1_MEAS_VOLTAGE_MSB)] << 8 |
+        raw[TELEM_OFFSET(OUTPUT1_MEAS_VOLTAGE_LSB)]), telem->volts_scale);
+    telem->amps = psu_pow((uint16_t)(raw[TELEM_OFFSET(OUTPUT1_MEAS_CURRENT_MSB)] << 8 |
+        raw[TELEM_OFFSET(OUTPUT1_MEAS_CURRENT_LSB)]), telem->amps_scale);
+}
+
+/*
+ * Voltage and current in one sequential read, so each MSB/LSB pair comes
+ * from the same conversion.
+ */
+bool fnppsu_output1_read_telemetry(uint8_t addr, fnppsu_telemetry_t *telem)
+{
+    fnppsu_cache_t *cache = fnppsu_cache_get(addr);
+    uint8_t raw[FNPPSU_TELEMETRY_LEN];
+    PERF_SCOPE(PERF_PSU_TELEMETRY);
+
+    if (!i2c_read_buf(addr, OUTPUT1_MEAS_VOLTAGE_MSB, raw, fnppsu_telemetry_len(cache))) {
+        fnppsu_cache_invalidate(addr);
         return false;
+    }
 
-    *result = psu_pow((uint16_t)(msb << 8 | lsb), scale);
+    fnppsu_decode_telemetry(raw, cache, telem);
     return true;
 }
 
-bool fnppsu_output1_write_set_voltage(uint8_t addr, uint16_t voltage)
+static void fnppsu_poll_done(i2c_xfer_t *xfer)
 {
-    uint8_t msb;
-    uint8_t lsb;
-    uint8_t scale;
+    fnppsu_meas_t *meas = (fnppsu_meas_t *)xfer->data;
+    uint8_t *raw = meas->raw;
 
-    if (!i2c_read(addr, OUTPUT1_SET_VOLTAGE_SCALE, &scale))
-        return false;
+    meas->ok = (xfer->status == I2C_XFER_OK);
 
-    if (scale != 0x00)
-        return false;
+    if (!meas->ok) {
+        fnppsu_cache_invalidate(xfer->addr);
+    } else if (meas->group < FNPPSU_POLL_SCALED) {
+        meas->value = psu_pow((uint16_t)(raw[0] << 8 | raw[1]), raw[2]);
+    } else {
+        meas->value = (uint32_t)raw[0] << 24 | (uint32_t)raw[1] << 16 | (uint16_t)raw[2] << 8 | raw[3];
+    }
 
-    voltage *= 10;
+    meas->callback(meas);
+}
 
-    msb = (uint8_t)(voltage >> 8);
-    lsb = (uint8_t)(voltage & 0xFF);
+/*
+ * Queues a read of one poll group in the background. meas->callback is
+ * invoked from i2c_process() once it has completed, with the scaled value
+ * (or raw count for FNPPSU_POLL_HOURS) in meas->value.
+ */
+bool fnppsu_poll_async(fnppsu_meas_t *meas, uint8_t addr, uint8_t group)
+{
+    i2c_xfer_t *xfer = &meas->xfer;
+    fnppsu_poll_group_t info;
+    fnppsu_cache_t *cache;
+    PERF_SCOPE(PERF_PSU_POLL);
+
+    fnppsu_poll_group(group, &info);
+
+    meas->group = group;
+
+    xfer->addr = addr;
+    xfer->reg = info.reg;
+    xfer->buf = meas->raw;
+    xfer->len = info.len;
+    xfer->flags = I2C_XFER_READ;
+    xfer->callback = &fnppsu_poll_done;
+    xfer->data = meas;
+
+    // The scale goes in raw[2] either way. Taken from the cache now, as the
+    // entry may be gone by the time the read completes.
+    if (group < FNPPSU_POLL_SCALED) {
+        cache = fnppsu_cache_get(addr);
+        if (cache)
+            meas->raw[2] = cache->scales[group];
+        else
+            xfer->len++;
+    }
 
-    if (!i2c_write(addr, OUTPUT1_SET_VOLTAGE_MSB, msb))
-        return false;
-    
-    _delay_ms(8);
+    return i2c_submit(xfer);
+}
 
-    if (!i2c_write(addr, OUTPUT1_SET_VOLTAGE_LSB, lsb))
-        return false;
-    
-    _delay_ms(8);
-    
-    return true;
+static bool fnppsu_read_set_scale(uint8_t addr, uint8_t *scale)
+{
+    fnppsu_cache_t *cache = fnppsu_cache_get(addr);
+
+    if (cache) {
+        *scale = cache->scales[FNPPSU_POLL_SET_VOLTAGE];
+        return true;
+    }
+
+    return i2c_read(addr, OUTPUT1_SET_VOLTAGE_SCALE, scale);
 }
 
 bool fnppsu_output1_read_set_voltage(uint8_t addr, uint16_t *result)
 {
-    uint8_t msb;
-    uint8_t lsb;
-    uint8_t scale;
+    fnppsu_cache_t *cache = fnppsu_cache_get(addr);
+    uint8_t raw[3]; // MSB, LSB, SCALE
+    PERF_SCOPE(PERF_PSU_READ_SV);
 
-    if (!i2c_read(addr, OUTPUT1_SET_VOLTAGE_MSB, &msb))
-        return false;
-    if (!i2c_read(addr, OUTPUT1_SET_VOLTAGE_LSB, &lsb))
-        return false;
-    if (!i2c_read(addr, OUTPUT1_SET_VOLTAGE_SCALE, &scale))
+    if (!i2c_read_buf(addr, OUTPUT1_SET_VOLTAGE_MSB, raw, cache ? 2 : 3)) {
+        fnppsu_cache_invalidate(addr);
         return false;
+    }
 
-    *result = psu_pow((uint16_t)(msb << 8 | lsb), scale);
+    if (cache)
+        raw[2] = cache->scales[FNPPSU_POLL_SET_VOLTAGE];
+
+    *result = psu_pow((uint16_t)(raw[0] << 8 | raw[1]), raw[2]);
     return true;
 }
 
+typedef struct {
+    const uint8_t *addrs;
+    uint8_t mask;
+    uint8_t failed;
+    uint16_t voltage;
+    uint8_t flags;
+    uint8_t state;
+    int8_t timer;
+    void (*callback)(uint8_t mask, uint8_t failed, void *data);
+    void *data;
+} fnppsu_fleet_t;
+
+static fnppsu_fleet_t _g_fleet = { .timer = -1 };
+
+static bool fnppsu_fleet_write(fnppsu_fleet_t *fleet, uint8_t addr, bool msb)
+{
+    uint16_t raw = fleet->voltage * 10;
+
+    if (msb)
+        return i2c_write(addr, OUTPUT1_SET_VOLTAGE_MSB, (uint8_t)(raw >> 8));
+
+    return i2c_write(addr, OUTPUT1_SET_VOLTAGE_LSB, (uint8_t)(raw & 0xFF));
+}
 
+static void fnppsu_fleet_step(void *param)
+{
+    fnppsu_fleet_t *fleet = (fnppsu_fleet_t *)param;
+    uint8_t todo = fleet->mask & ~fleet->failed;
+    uint8_t i;
+
+    for (i = 0; i < MAX_PSU; i++) {
+        uint8_t addr = fleet->addrs[i];
+        uint16_t sv;
+
+        if (!(todo & _BV(i)))
+            continue;
+
+        if (fleet->state == FLEET_WRITE_SECOND) {
+            if (!fnppsu_fleet_write(fleet, addr, fleet->flags & FNPPSU_FLEET_LSB_FIRST)) {
+                fnppsu_cache_invalidate(addr);
+                fleet->failed |= _BV(i);
+            }
+        } else {
+            if (!fnppsu_output1_read_set_voltage(addr, &sv) || sv != fleet->voltage)
+                fleet->failed |= _BV(i);
+        }
+    }
+
+    if (fleet->state == FLEET_WRITE_SECOND) {
+        fleet->state = FLEET_VERIFY;
+        timeout_start(fleet->timer);
+        return;
+    }
+
+    fleet->state = FLEET_IDLE;
+    fleet->callback(fleet->mask, fleet->failed, fleet->data);
+}
+
+/*
+ * Changes the set voltage of every PSU in mask (bit n = addrs[n]) in one
+ * pass: all MSBs, one write delay, all LSBs, one write delay, then read
+ * back and verify all of them. The delays run on a timer so this returns
+ * straight away. callback is invoked with the PSUs that failed.
+ *
+ * FNPPSU_FLEET_LSB_FIRST swaps the write order. While the two bytes are
+ * half written the PSU regulates to the new byte paired with the old
+ * one. When the MSB changes that is up to 255 mV off. Writing the LSB
+ * first when raising and the MSB first when lowering keeps it below both
+ * old and new rather than above. See psu_hitless_step().
+ */
+bool fnppsu_output1_write_set_voltage_fleet(const uint8_t *addrs, uint8_t mask, uint16_t voltage, uint8_t flags,
+    void (*callback)(uint8_t mask, uint8_t failed, void *data), void *data)
+{
+    fnppsu_fleet_t *fleet = &_g_fleet;
+    uint8_t i;
+    PERF_SCOPE(PERF_PSU_WRITE_SV);
+
+    if (fleet->state != FLEET_IDLE)
+        return false;
+
+    if (fleet->timer < 0) {
+        fleet->timer = timeout_create(SET_VOLTAGE_WRITE_DELAY_MS, false, false, &fnppsu_fleet_step, fleet);
+        if (fleet->timer < 0)
+            return false;
+    }
+
+    fleet->addrs = addrs;
+    fleet->mask = mask;
+    fleet->failed = 0;
+    fleet->voltage = voltage;
+    fleet->flags = flags;
+    fleet->callback = callback;
+    fleet->data = data;
+
+    for (i = 0; i < MAX_PSU; i++) {
+        uint8_t addr = addrs[i];
+        uint8_t scale;
+
+        if (!(mask & _BV(i)))
+            continue;
+
+        if (!fnppsu_read_set_scale(addr, &scale) || scale != 0x00 ||
+                !fnppsu_fleet_write(fleet, addr, !(flags & FNPPSU_FLEET_LSB_FIRST))) {
+            fnppsu_cache_invalidate(addr);
+            fleet->failed |= _BV(i);
+        }
+    }
+
+    fleet->state = FLEET_WRITE_SECOND;
+    timeout_start(fleet->timer);
+
+    return true;
+}
@@ -26,6 +26,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "i2c.h"
+
 #define FNPPSU_I2C_ADDR_MIN     0x41
 #define FNPPSU_I2C_ADDR_MAX     0x60
 
@@ -34,6 +36,18 @@
 #define FNPPSU_MAX_SERIAL       12
 #define FNPPSU_MAX_REV          4
 
+#define FNPPSU_FLEET_LSB_FIRST  0x01
+
+#define FNPPSU_TELEMETRY_LEN    15 /* 0x8A (voltage MSB) to 0x98 (current scale) */
+
+/* Poll groups. Those below FNPPSU_POLL_SCALED have a scale register */
+#define FNPPSU_POLL_CURRENT     0
+#define FNPPSU_POLL_VOLTAGE     1
+#define FNPPSU_POLL_SET_VOLTAGE 2
+#define FNPPSU_POLL_SCALED      3
+#define FNPPSU_POLL_HOURS       3
+#define FNPPSU_POLL_GROUPS      4
+
 typedef struct {
     char mfg[FNPPSU_MAX_MODEL + 1];
     char model[FNPPSU_MAX_MODEL + 1];
@@ -45,10 +59,41 @@ typedef struct {
     uint32_t hours_in_service;
 } fnppsu_dev_info_t;
 
+typedef struct {
+    uint16_t volts;
+    uint16_t amps;
+    uint8_t volts_scale;
+    uint8_t amps_scale;
+} fnppsu_telemetry_t;
+
+typedef struct {
+    uint8_t reg;
+    uint8_t len;        // Value bytes, not counting the scale register
+    uint8_t rate;       // Polled every rate * sample_interval
+    uint8_t priority;   // Lowest goes first when several groups are due
+} fnppsu_poll_group_t;
+
+typedef struct fnppsu_meas fnppsu_meas_t;
+
+struct fnppsu_meas {
+    i2c_xfer_t xfer;
+    uint8_t raw[4];
+    uint8_t group;
+    uint32_t value;
+    bool ok;
+    void (*callback)(fnppsu_meas_t *meas);
+    void *data;
+};
+
 bool fnppsu_get_dev_info(uint8_t addr, fnppsu_dev_info_t *info);
-bool fnppsu_output1_read_meas_voltage(uint8_t addr, uint16_t *result);
-bool fnppsu_output1_read_meas_current(uint8_t addr, uint16_t *result);
-bool fnppsu_output1_write_set_voltage(uint8_t addr, uint16_t voltage);
+bool fnppsu_get_serial(uint8_t addr, char *serial);
+bool fnppsu_cache_fill(uint8_t addr);
+void fnppsu_cache_clear(void);
+bool fnppsu_output1_read_telemetry(uint8_t addr, fnppsu_telemetry_t *telem);
+void fnppsu_poll_group(uint8_t group, fnppsu_poll_group_t *info);
+bool fnppsu_poll_async(fnppsu_meas_t *meas, uint8_t addr, uint8_t group);
 bool fnppsu_output1_read_set_voltage(uint8_t addr, uint16_t *result);
+bool fnppsu_output1_write_set_voltage_fleet(const uint8_t *addrs, uint8_t mask, uint16_t voltage, uint8_t flags,
+    void (*callback)(uint8_t mask, uint8_t failed, void *data), void *data);
 
 #endif /* __fnppsu_H__ */
@@ -0,0 +1,35 @@
+/*
+ *   File:   avr/interrupt.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 22:37
+ *
+ *   Just enough of avr-libc's <avr/interrupt.h> for the host builds in
+ *   this directory. An ISR is a plain function the test calls itself, and
+ *   cli() and sei() only flip the I bit in the SREG variable.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOST_AVR_INTERRUPT_H__
+#define __HOST_AVR_INTERRUPT_H__
+
+#include <avr/io.h>
+
+#define ISR(vector) void vector(void)
+
+#define cli()       (SREG &= ~_BV(SREG_I))
+#define sei()       (SREG |= _BV(SREG_I))
+
+#endif /* __HOST_AVR_INTERRUPT_H__ */
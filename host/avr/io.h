@@ -0,0 +1,50 @@
+/*
+ *   File:   avr/io.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 22:25
+ *
+ *   Just enough of avr-libc's <avr/io.h> for the host builds in this
+ *   directory. Registers are plain variables, defined by whichever host
+ *   program uses them.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOST_AVR_IO_H__
+#define __HOST_AVR_IO_H__
+
+#include <stdint.h>
+
+#define _BV(bit)    (1 << (bit))
+
+#define PC3         3
+
+#define WGM12       3
+#define CS11        1
+#define OCIE1A      1
+#define OCF1A       1
+#define SREG_I      7
+
+extern volatile uint8_t PORTC;
+
+extern volatile uint8_t SREG;
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint8_t TIMSK1;
+extern volatile uint8_t TIFR1;
+extern volatile uint16_t OCR1A;
+extern volatile uint16_t TCNT1;
+
+#endif /* __HOST_AVR_IO_H__ */
@@ -0,0 +1,300 @@
+/*
+ *   File:   modbus_host.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 22:25
+ *
+ *   Runs modbus.c on Linux, for testing against a real Modbus master
+ *   without the board. The console UART is the master side of a pty,
+ *   whose name is printed on stdout. The PSUs are two canned samples, and
+ *   the calls modbus.c makes into the rest of the firmware only update
+ *   the config and the PS_ON bit. See modbus_test.py.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <avr/io.h>
+
+#include "config.h"
+#include "main.h"
+#include "modbus.h"
+#include "sampler.h"
+#include "timeout.h"
+#include "usart_buffered.h"
+#include "util.h"
+
+#define HOST_RX_SIZE    256
+#define HOST_TIMERS     4
+#define HOST_PSUS       2
+
+typedef struct {
+    bool used;
+    bool running;
+    bool repeat;
+    uint32_t interval;
+    uint32_t due;
+    void (*callback)(void *);
+    void *data;
+} host_timer_t;
+
+volatile uint8_t PORTC = _BV(PS_ON); // Off, as io_init() leaves it
+
+psu_sample_t _g_samples[MAX_PSU];
+
+static sys_config_t _g_cfg;
+static sys_runstate_t _g_rs;
+static int _g_pty = -1;
+static uint8_t _g_rx[HOST_RX_SIZE];
+static uint16_t _g_rx_head;
+static uint16_t _g_rx_tail;
+static host_timer_t _g_timers[HOST_TIMERS];
+
+uint32_t get_tick_count(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+int8_t timeout_create(uint32_t interval, bool start, bool repeat, void (*callback)(void *), void *data)
+{
+    int8_t i;
+
+    for (i = 0; i < HOST_TIMERS; i++) {
+        host_timer_t *t = &_g_timers[i];
+
+        if (t->used)
+            continue;
+
+        t->used = true;
+        t->repeat = repeat;
+        t->interval = interval;
+        t->callback = callback;
+        t->data = data;
+        t->running = false;
+
+        if (start)
+            timeout_start(i);
+
+        return i;
+    }
+
+    return -1;
+}
+
+void timeout_destroy(int8_t index)
+{
+    _g_timers[index].used = false;
+    _g_timers[index].running = false;
+}
+
+void timeout_start(int8_t index)
+{
+    _g_timers[index].due = get_tick_count() + _g_timers[index].interval;
+    _g_timers[index].running = true;
+}
+
+void timeout_stop(int8_t index)
+{
+    _g_timers[index].running = false;
+}
+
+void timeout_check(void)
+{
+    uint32_t now = get_tick_count();
+    int8_t i;
+
+    for (i = 0; i < HOST_TIMERS; i++) {
+        host_timer_t *t = &_g_timers[i];
+
+        if (!t->used || !t->running || !tick_reached(now, t->due))
+            continue;
+
+        if (t->repeat)
+            t->due += t->interval;
+        else
+            t->running = false;
+
+        t->callback(t->data);
+    }
+}
+
+bool usart1_data_ready(void)
+{
+    return _g_rx_head != _g_rx_tail;
+}
+
+char usart1_get(void)
+{
+    char c = _g_rx[_g_rx_tail];
+
+    _g_rx_tail = (_g_rx_tail + 1) % HOST_RX_SIZE;
+    return c;
+}
+
+bool usart1_put(char c)
+{
+    return write(_g_pty, &c, 1) == 1;
+}
+
+void usart1_set_flow_control(bool enable)
+{
+    (void)enable;
+}
+
+void console_mute(bool mute)
+{
+    (void)mute;
+}
+
+void save_configuration(sys_config_t *config)
+{
+    (void)config;
+}
+
+bool psu_set_output_voltage(sys_runstate_t *rs, uint16_t volts)
+{
+    if (volts < OUTPUT_VOLTAGE_MIN || volts > OUTPUT_VOLTAGE_MAX)
+        return false;
+
+    rs->config->output_voltage = volts;
+    return true;
+}
+
+bool psu_change_state(sys_runstate_t *rs, bool on)
+{
+    (void)rs;
+
+    if (on)
+        PORTC &= ~_BV(PS_ON);
+    else
+        PORTC |= _BV(PS_ON);
+
+    return true;
+}
+
+void sampler_totals(uint8_t psu_num, psu_totals_t *totals)
+{
+    uint32_t volts = 0;
+    uint8_t i;
+
+    totals->good = 0;
+    totals->amps = 0;
+    totals->watts = 0;
+
+    for (i = 0; i < psu_num; i++) {
+        psu_sample_t *sample = &_g_samples[i];
+
+        if (!(sample->flags & SAMPLE_VALID) || (sample->flags & SAMPLE_ERROR))
+            continue;
+
+        volts += sample->volts;
+        totals->amps += sample->amps;
+        totals->watts += (uint32_t)sample->volts * sample->amps / 100;
+        totals->good++;
+    }
+
+    totals->avg_volts = totals->good ? volts / totals->good : 0;
+}
+
+static void host_pty_open(void)
+{
+    struct termios tio;
+
+    _g_pty = posix_openpt(O_RDWR | O_NOCTTY);
+    if (_g_pty < 0 || grantpt(_g_pty) || unlockpt(_g_pty)) {
+        perror("pty");
+        exit(1);
+    }
+
+    // No echo or line discipline, like a UART
+    tcgetattr(_g_pty, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(_g_pty, TCSANOW, &tio);
+
+    fprintf(stdout, "%s\n", ptsname(_g_pty));
+    fflush(stdout);
+}
+
+static void host_rx(void)
+{
+    struct pollfd pfd = { .fd = _g_pty, .events = POLLIN };
+    uint8_t c;
+
+    if (poll(&pfd, 1, 1) <= 0 || !(pfd.revents & POLLIN))
+        return;
+
+    // Stops at a full ring, as a byte at a time from the UART would
+    while ((_g_rx_head + 1) % HOST_RX_SIZE != _g_rx_tail && read(_g_pty, &c, 1) == 1) {
+        _g_rx[_g_rx_head] = c;
+        _g_rx_head = (_g_rx_head + 1) % HOST_RX_SIZE;
+
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+            break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    sys_runstate_t *rs = &_g_rs;
+    uint8_t i;
+    char c;
+
+    rs->config = &_g_cfg;
+    rs->config->output_voltage = OUTPUT_VOLTAGE_DEFAULT;
+    rs->config->baud = UART1_BAUD;
+    rs->config->modbus_addr = argc > 1 ? atoi(argv[1]) : 1;
+    rs->psu_num = HOST_PSUS;
+
+    for (i = 0; i < HOST_PSUS; i++) {
+        rs->psu_addrs[i] = FNPPSU_I2C_ADDR_MIN + i;
+        _g_samples[i].addr = rs->psu_addrs[i];
+        _g_samples[i].flags = SAMPLE_VALID;
+        _g_samples[i].volts = 1200 + i;
+        _g_samples[i].amps = 1000 + 500 * i;
+    }
+
+    host_pty_open();
+
+    if (!modbus_start(rs))
+        return 1;
+
+    // Setting the slave address to 0 ends it, as it hands the port back
+    while (modbus_active()) {
+        host_rx();
+        modbus_process(rs);
+        timeout_check();
+    }
+
+    // Closing our end now could lose the last reply. Wait for the master to close
+    while (read(_g_pty, &c, 1) > 0)
+        ;
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+#
+# File:   modbus_test.py
+# Author: agent
+#
+# FNP600/850/1000 Adapter Board
+#
+# Created on 16 October 2026, 22:25
+#
+# Drives the host build of the Modbus RTU slave (modbus_host.c) over its
+# pty with pymodbus as the master. Covers functions 03, 04, 06 and 16 and
+# the exception replies. Needs pymodbus (3.x) and pyserial.
+#
+#   make test-modbus
+#   python3 host/modbus_test.py host/modbus_host
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# You should have received a copy of the GNU General Public License
+# along with this software.  If not, see <http://www.gnu.org/licenses/>.
+
+import inspect
+import subprocess
+import sys
+
+from pymodbus.client import ModbusSerialClient
+from pymodbus.exceptions import ModbusException
+
+SLAVE = 1
+
+EX_FUNCTION = 1
+EX_ADDRESS = 2
+EX_VALUE = 3
+
+failures = 0
+
+
+def check(name, ok):
+    global failures
+    print("%-50s %s" % (name, "ok" if ok else "FAIL"))
+    if not ok:
+        failures += 1
+
+
+def call(fn, *args, slave=SLAVE, **kwargs):
+    # The slave id keyword has been renamed between pymodbus releases
+    params = inspect.signature(fn).parameters
+    for name in ("device_id", "slave", "unit"):
+        if name in params:
+            kwargs[name] = slave
+            break
+    try:
+        return fn(*args, **kwargs)
+    except ModbusException as ex:
+        return ex
+
+
+def ok(rr):
+    return not isinstance(rr, ModbusException) and not rr.isError()
+
+
+def regs(rr):
+    if isinstance(rr, ModbusException) or rr.isError():
+        return None
+    return list(rr.registers)
+
+
+def exception_code(rr):
+    if isinstance(rr, ModbusException) or not rr.isError():
+        return None
+    return getattr(rr, "exception_code", None)
+
+
+def no_reply(rr):
+    return isinstance(rr, ModbusException) or (rr.isError() and exception_code(rr) is None)
+
+
+def main():
+    slave = subprocess.Popen([sys.argv[1], str(SLAVE)], stdout=subprocess.PIPE, text=True)
+    port = slave.stdout.readline().strip()
+
+    client = ModbusSerialClient(port, baudrate=9600, timeout=0.5, retries=0)
+    if not client.connect():
+        slave.kill()
+        sys.exit("Can't open %s" % port)
+
+    # 04: totals, then the two canned PSUs (1200 and 1201, 10.00 A and 15.00 A)
+    check("04 totals", regs(call(client.read_input_registers, 0, count=6)) == [2, 2500, 1200, 0, 0, 2500])
+    check("04 PSU slots", regs(call(client.read_input_registers, 10, count=6)) == [1200, 1000, 1, 1201, 1500, 1])
+    check("04 empty PSU slots read 0", regs(call(client.read_input_registers, 16, count=18)) == [0] * 18)
+    check("04 past the last PSU", exception_code(call(client.read_input_registers, 34, count=1)) == EX_ADDRESS)
+    check("04 register 778", exception_code(call(client.read_input_registers, 778, count=1)) == EX_ADDRESS)
+    check("04 too many registers", exception_code(call(client.read_input_registers, 0, count=33)) == EX_VALUE)
+
+    # 03
+    check("03 holding registers", regs(call(client.read_holding_registers, 0, count=4)) == [1200, 0, 0, 1])
+    check("03 past the last register", exception_code(call(client.read_holding_registers, 3, count=2)) == EX_ADDRESS)
+
+    # 06
+    check("06 output voltage", ok(call(client.write_register, 0, 1100)))
+    check("06 read back", regs(call(client.read_holding_registers, 0, count=1)) == [1100])
+    check("06 voltage out of range", exception_code(call(client.write_register, 0, 2000)) == EX_VALUE)
+    check("06 unknown register", exception_code(call(client.write_register, 9, 0)) == EX_ADDRESS)
+    check("06 output on", ok(call(client.write_register, 2, 1)))
+    check("04 status shows output on", regs(call(client.read_input_registers, 3, count=1)) == [1])
+
+    # 16
+    check("16 voltage and start mode", ok(call(client.write_registers, 0, [1150, 1])))
+    check("16 read back", regs(call(client.read_holding_registers, 0, count=2)) == [1150, 1])
+    check("16 past the last register", exception_code(call(client.write_registers, 3, [1, 1])) == EX_ADDRESS)
+    check("16 start mode out of range", exception_code(call(client.write_registers, 1, [2])) == EX_VALUE)
+
+    # Other functions and other slaves
+    check("01 unsupported function", exception_code(call(client.read_coils, 0, count=1)) == EX_FUNCTION)
+    check("other slave address ignored", no_reply(call(client.read_input_registers, 0, count=1, slave=SLAVE + 1)))
+
+    # Address 0 hands the port back, which ends the host build once we let go
+    check("06 slave address 0", ok(call(client.write_register, 3, 0)))
+    client.close()
+    try:
+        check("slave address 0 stops the slave", slave.wait(timeout=2) == 0)
+    except subprocess.TimeoutExpired:
+        check("slave address 0 stops the slave", False)
+        slave.kill()
+
+    print("%d failed" % failures if failures else "All passed")
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
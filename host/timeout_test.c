@@ -0,0 +1,165 @@
+/*
+ *   File:   timeout_test.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 22:37
+ *
+ *   Runs timeout.c and task.c on Linux across the two places the 1 ms
+ *   tick count wraps: 2^31, where it goes negative as a signed number,
+ *   and 2^32, 49 days in. The Timer1 ISR is called directly, one tick at
+ *   a time, with timeout_check() after each as the idle loop would. Built
+ *   at -Os, as the firmware is, so a compare that relies on signed
+ *   overflow gets optimised the same way.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "task.h"
+#include "timeout.h"
+
+#define TEST_TICKS      4000
+#define TEST_PERIOD     500
+#define MAX_FIRES       32 // Far more than TEST_TICKS / TEST_PERIOD. Stops a runaway
+
+volatile uint8_t SREG = _BV(SREG_I);
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint8_t TIMSK1;
+volatile uint8_t TIFR1;
+volatile uint16_t OCR1A;
+volatile uint16_t TCNT1;
+
+extern volatile uint32_t _g_tick_count;
+
+void TIMER1_COMPA_vect(void);
+
+typedef struct {
+    uint8_t count;
+    uint32_t at[MAX_FIRES];
+} fires_t;
+
+static uint8_t _g_failures;
+
+static void check(const char *name, uint32_t start, bool ok)
+{
+    printf("%-44s from 0x%08lX  %s\n", name, (unsigned long)start, ok ? "ok" : "FAIL");
+
+    if (!ok)
+        _g_failures++;
+}
+
+static void fired(void *param)
+{
+    fires_t *fires = (fires_t *)param;
+
+    if (fires->count == MAX_FIRES) {
+        printf("Runaway timer at tick 0x%08lX\n", (unsigned long)get_tick_count());
+        exit(1);
+    }
+
+    fires->at[fires->count++] = get_tick_count();
+}
+
+static void tick(void)
+{
+    TIMER1_COMPA_vect();
+    timeout_check();
+}
+
+static void start_at(uint32_t start)
+{
+    timeout_init();
+    _g_tick_count = start;
+}
+
+static void test_repeat(uint32_t start)
+{
+    fires_t fires = { 0 };
+    bool ok;
+    uint16_t i;
+
+    start_at(start);
+    timeout_create(TEST_PERIOD, true, true, &fired, &fires);
+
+    for (i = 0; i < TEST_TICKS; i++)
+        tick();
+
+    // First one a tick late (see timeout_start()), then on the beat
+    ok = fires.count == (TEST_TICKS - 1) / TEST_PERIOD;
+    for (i = 0; ok && i < fires.count; i++)
+        ok = fires.at[i] - start == TEST_PERIOD + 1 + (uint32_t)i * TEST_PERIOD;
+
+    check("Repeating timer keeps its period", start, ok);
+}
+
+static void test_order(uint32_t start)
+{
+    fires_t fires = { 0 };
+    uint16_t i;
+
+    start_at(start);
+    // Started long first, so only the deadlines put them in order
+    timeout_create(1500, true, false, &fired, &fires);
+    timeout_create(300, true, false, &fired, &fires);
+
+    for (i = 0; i < TEST_TICKS; i++)
+        tick();
+
+    check("One-shot timers fire in deadline order", start,
+        fires.count == 2 && fires.at[0] - start == 301 && fires.at[1] - start == 1501);
+}
+
+static void test_task_wait(uint32_t start)
+{
+    task_t task;
+    uint16_t i;
+
+    start_at(start);
+    task_set_deadline(&task, TEST_PERIOD);
+
+    for (i = 0; i < TEST_TICKS && !task_expired(&task); i++)
+        tick();
+
+    // Rounded up plus a tick, never short
+    check("Task wait is neither short nor long", start, i == TEST_PERIOD + 1);
+}
+
+int main(void)
+{
+    static const uint32_t starts[] = {
+        0x7FFFFFFFUL - TEST_TICKS / 2,  // Signed wrap, 24.8 days
+        0xFFFFFFFFUL - TEST_TICKS / 2,  // Unsigned wrap, 49.7 days
+        0x7FFFFFFFUL - TEST_PERIOD,     // Deadline lands right on the signed wrap
+        0,
+    };
+    uint8_t i;
+
+    for (i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+        test_repeat(starts[i]);
+        test_order(starts[i]);
+        test_task_wait(starts[i]);
+    }
+
+    printf(_g_failures ? "%u failed\n" : "All passed\n", _g_failures);
+    return _g_failures ? 1 : 0;
+}
@@ -25,170 +25,258 @@
 #include <stdio.h>
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <util/twi.h>
-#include <util/delay.h>
 
 #include "i2c.h"
+#include "timeout.h"
+#include "latency.h"
 
 #define I2C_PRESCALER 1
 #define I2C_READ    1
 #define I2C_WRITE   0
 
-void i2c_init(uint16_t freq_khz)
+#define I2C_QUEUE_LEN       8
+#define I2C_QUEUE_MASK      (I2C_QUEUE_LEN - 1)
+
+#if (I2C_QUEUE_LEN & I2C_QUEUE_MASK)
+#error I2C queue length is not a power of 2
+#endif
+
+#define I2C_NACK_RETRIES    100 /* Device busy (e.g. writing EEPROM). Retry the address */
+#define I2C_XFER_TIMEOUT_MS 200
+#define I2C_TIMEOUT_TICKS   (I2C_XFER_TIMEOUT_MS / TIMEOUT_MS_PER_TICK)
+
+#define I2C_TWCR_GO         (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+
+/*
+ * Transfers are queued by pointer. The caller owns the descriptor and must
+ * keep it alive until its callback has run (or i2c_process() has retired it).
+ *
+ * head:   Next free slot. Written by i2c_submit()
+ * active: Transfer on the bus. Advanced by the ISR on completion
+ * tail:   Next completed transfer to hand back. Advanced by i2c_process()
+ */
+static i2c_xfer_t *_g_i2c_queue[I2C_QUEUE_LEN];
+static volatile uint8_t _g_i2c_head;
+static volatile uint8_t _g_i2c_active;
+static uint8_t _g_i2c_tail;
+
+static i2c_xfer_t *_g_i2c_cur;
+static volatile bool _g_i2c_busy;
+static uint8_t _g_i2c_idx;
+static uint8_t _g_i2c_retries;
+static bool _g_i2c_reg_sent;
+static uint32_t _g_i2c_started;
+
+static void i2c_begin(uint8_t stop)
 {
-    TWSR = 0;
-	TWBR = (uint8_t)((((F_CPU / freq_khz * 1000) / I2C_PRESCALER) - 16) / 2);
+    i2c_xfer_t *xfer = _g_i2c_queue[_g_i2c_active];
+
+    _g_i2c_cur = xfer;
+    _g_i2c_idx = 0;
+    _g_i2c_reg_sent = (xfer->flags & I2C_XFER_NOREG) != 0;
+    _g_i2c_retries = (xfer->flags & I2C_XFER_PROBE) ? 0 : I2C_NACK_RETRIES;
+    _g_i2c_started = get_tick_count();
+    _g_i2c_busy = true;
+
+    // send START condition (after STOP if chaining from a previous transfer)
+    TWCR = I2C_TWCR_GO | _BV(TWSTA) | stop;
 }
 
-bool i2c_sync(void)
+static void i2c_complete(uint8_t status)
 {
-    uint16_t timeout = 500;
+    _g_i2c_cur->status = status;
+    _g_i2c_active = (_g_i2c_active + 1) & I2C_QUEUE_MASK;
 
-    while (!(TWCR & _BV(TWINT)) && timeout)
+    if (_g_i2c_active != _g_i2c_head)
     {
-        _delay_us(1);
-        timeout--;
+        // More queued. STOP and START again in one go
+        i2c_begin(_BV(TWSTO));
+    }
+    else
+    {
+        _g_i2c_busy = false;
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
     }
-    return (timeout != 0);
 }
 
-uint8_t i2c_wait_stop(void)
+ISR(TWI_vect)
 {
-    uint16_t timeout = 500;
-
-    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+    i2c_xfer_t *xfer = _g_i2c_cur;
+    LATENCY_ISR(LATENCY_TWI);
 
-    while ((TWCR & _BV(TWSTO)) && timeout)
+    switch (TW_STATUS)
     {
-        _delay_us(1);
-        timeout--;
+    case TW_START:
+    case TW_REP_START:
+        // send device address. Read direction only once the register is out
+        if ((xfer->flags & I2C_XFER_READ) && _g_i2c_reg_sent)
+            TWDR = (xfer->addr << 1) | I2C_READ;
+        else
+            TWDR = (xfer->addr << 1) | I2C_WRITE;
+        TWCR = I2C_TWCR_GO;
+        break;
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+        if (xfer->flags & I2C_XFER_PROBE)
+        {
+            i2c_complete(I2C_XFER_OK); // Somebody's home
+        }
+        else if (!_g_i2c_reg_sent)
+        {
+            _g_i2c_reg_sent = true;
+            TWDR = xfer->reg;
+            TWCR = I2C_TWCR_GO;
+        }
+        else if (xfer->flags & I2C_XFER_READ)
+        {
+            TWCR = I2C_TWCR_GO | _BV(TWSTA); // Repeated START
+        }
+        else if (_g_i2c_idx < xfer->len)
+        {
+            TWDR = xfer->buf[_g_i2c_idx++];
+            TWCR = I2C_TWCR_GO;
+        }
+        else
+        {
+            i2c_complete(I2C_XFER_OK);
+        }
+        break;
+    case TW_MR_DATA_ACK:
+        xfer->buf[_g_i2c_idx++] = TWDR;
+        /* fall through */
+    case TW_MR_SLA_ACK:
+        // ACK everything except the last byte
+        if (_g_i2c_idx + 1 < xfer->len)
+            TWCR = I2C_TWCR_GO | _BV(TWEA);
+        else
+            TWCR = I2C_TWCR_GO;
+        break;
+    case TW_MR_DATA_NACK:
+        xfer->buf[_g_i2c_idx++] = TWDR;
+        i2c_complete(I2C_XFER_OK);
+        break;
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+        if (_g_i2c_retries)
+        {
+            // device busy, send stop condition then start over
+            _g_i2c_retries--;
+            _g_i2c_idx = 0;
+            _g_i2c_reg_sent = (xfer->flags & I2C_XFER_NOREG) != 0;
+            TWCR = I2C_TWCR_GO | _BV(TWSTO) | _BV(TWSTA);
+            break;
+        }
+        /* fall through */
+    default:
+        // Data NACK, arbitration lost or bus error
+        i2c_complete(I2C_XFER_FAILED);
+        break;
     }
-
-    return (timeout != 0);
 }
 
-uint8_t i2c_start_wait(uint8_t addr)
+void i2c_init(uint16_t freq_khz)
 {
-    uint8_t twst;
-    uint16_t retry = 100;
-
-    while (1)
-    {
-        // send START condition
-        TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+    _g_i2c_head = 0;
+    _g_i2c_active = 0;
+    _g_i2c_tail = 0;
+    _g_i2c_busy = false;
 
-        // wait until transmission completed
-        if (!i2c_sync())
-            break;
+    TWSR = 0;
+	TWBR = (uint8_t)((((F_CPU / freq_khz * 1000) / I2C_PRESCALER) - 16) / 2);
+    TWCR = _BV(TWEN);
+}
 
-        // check value of TWI Status Register. Mask prescaler bits.
-        twst = TW_STATUS & 0xF8;
-        if ((twst != TW_START) && (twst != TW_REP_START))
-            continue;
+bool i2c_submit(i2c_xfer_t *xfer)
+{
+    uint8_t tmphead = (_g_i2c_head + 1) & I2C_QUEUE_MASK;
 
-        // send device address
-        TWDR = addr;
-        TWCR = _BV(TWINT) | _BV(TWEN);
+    if (tmphead == _g_i2c_tail)
+        return false; // Queue full
 
-        // wail until transmission completed
-        if (!i2c_sync())
-            break;
+    xfer->status = I2C_XFER_PENDING;
+    _g_i2c_queue[_g_i2c_head] = xfer;
 
-        // check value of TWI Status Register. Mask prescaler bits.
-        twst = TW_STATUS & 0xF8;
-        if ((twst == TW_MT_SLA_NACK) || (twst == TW_MR_DATA_NACK))
-        {
-            /* device busy, send stop condition to terminate write operation */
-            if (!i2c_wait_stop())
-                continue;
+    g_irq_disable();
+    _g_i2c_head = tmphead;
+    if (!_g_i2c_busy)
+        i2c_begin(0);
+    g_irq_enable();
 
-            if (!(retry--))
-                break;
+    return true;
+}
 
-            continue;
-        }
+void i2c_process(void)
+{
+    i2c_xfer_t *xfer;
 
-        return true;
-        break;
+    g_irq_disable();
+    if (_g_i2c_busy && (get_tick_count() - _g_i2c_started) > I2C_TIMEOUT_TICKS)
+    {
+        // Bus hung. Kick the TWI and fail whatever was in progress
+        TWCR = 0;
+        i2c_complete(I2C_XFER_FAILED);
     }
+    g_irq_enable();
+
+    while (_g_i2c_tail != _g_i2c_active)
+    {
+        xfer = _g_i2c_queue[_g_i2c_tail];
+        _g_i2c_tail = (_g_i2c_tail + 1) & I2C_QUEUE_MASK;
 
-    return false;
+        if (xfer->callback)
+            xfer->callback(xfer);
+    }
 }
 
-static bool i2c_byte_out(uint8_t data)
+/*
+ * Blocking wrappers. These spin in i2c_process() until the transfer has been
+ * retired, so completion callbacks of any asynchronous transfers queued
+ * ahead of this one will run from here.
+ */
+static bool i2c_transfer(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len, uint8_t flags)
 {
-    uint8_t twst;
+    i2c_xfer_t xfer;
 
-    // send data to the previously addressed device
-    TWDR = data;
-    TWCR = _BV(TWINT) | _BV(TWEN);
+    xfer.addr = addr;
+    xfer.reg = reg;
+    xfer.buf = buf;
+    xfer.len = len;
+    xfer.flags = flags;
+    xfer.callback = NULL;
 
-    // wait until transmission completed
-    i2c_sync();
+    while (!i2c_submit(&xfer))
+        i2c_process();
 
-    // check value of TWI Status Register. Mask prescaler bits
-    twst = TW_STATUS & 0xF8;
-    if (twst != TW_MT_DATA_ACK)
-        return false;
+    while (xfer.status == I2C_XFER_PENDING)
+        i2c_process();
 
-    return true;
-}
+    // Retire it before the descriptor goes out of scope
+    i2c_process();
 
-static bool i2c_read_ack(uint8_t *ret)
-{
-    bool result;
-    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWEA);
-    result = i2c_sync();
-    *ret = TWDR;
-    return result;
+    return xfer.status == I2C_XFER_OK;
 }
 
-static bool i2c_read_nack(uint8_t *ret)
+/*
+ * Sends just the address and reports whether anything ACKed it. No retries,
+ * so an empty address costs a single START/address/STOP.
+ */
+bool i2c_probe(uint8_t addr)
 {
-    bool result;
-    TWCR = _BV(TWINT) | _BV(TWEN);
-    result = i2c_sync();
-    *ret = TWDR;
-    return result;
+    return i2c_transfer(addr, 0, NULL, 0, I2C_XFER_NOREG | I2C_XFER_PROBE);
 }
 
 #ifdef _I2C_XFER_
 
 bool i2c_read(uint8_t addr, uint8_t reg, uint8_t *ret)
 {
-    if (!i2c_start_wait(addr << 1 | I2C_WRITE))
-        goto fail;
-
-    if (!i2c_byte_out(reg))
-        goto fail;
-
-    if (!i2c_start_wait((addr << 1 | I2C_READ)))
-        goto fail;
-
-    if (!i2c_read_nack(ret))
-        goto fail;
-
-    return i2c_wait_stop();
-fail:
-    i2c_wait_stop();
-    return false;
+    return i2c_transfer(addr, reg, ret, 1, I2C_XFER_READ);
 }
 
 bool i2c_write(uint8_t addr, uint8_t reg, uint8_t data)
 {
-    if (!i2c_start_wait((addr << 1) | I2C_WRITE))
-        goto fail;
-
-    if (!i2c_byte_out(reg))
-        goto fail;
-
-    if (!i2c_byte_out(data))
-        goto fail;
-
-    return i2c_wait_stop();
-fail:
-    i2c_wait_stop();
-    return false;
+    return i2c_transfer(addr, reg, &data, 1, 0);
 }
 
 #endif /* _I2C_XFER_ */
@@ -197,30 +285,12 @@ fail:
 
 bool i2c_read_byte(uint8_t addr, uint8_t *ret)
 {
-    if (!i2c_start_wait((addr << 1) | I2C_READ))
-        goto fail;
-
-    if (!i2c_read_nack(ret))
-        goto fail;
-
-    return i2c_wait_stop();
-fail:
-    i2c_wait_stop();
-    return false;
+    return i2c_transfer(addr, 0, ret, 1, I2C_XFER_READ | I2C_XFER_NOREG);
 }
 
 bool i2c_write_byte(uint8_t addr, uint8_t data)
 {
-    if (!i2c_start_wait((addr << 1) | I2C_WRITE))
-        goto fail;
-
-    if (!i2c_byte_out(data))
-        goto fail;
-
-    return i2c_wait_stop();
-fail:
-    i2c_wait_stop();
-    return false;
+    return i2c_transfer(addr, 0, &data, 1, I2C_XFER_NOREG);
 }
 
 #endif /* _I2C_XFER_BYTE_ */
@@ -229,53 +299,12 @@ fail:
 
 bool i2c_write_buf(uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len)
 {
-    uint8_t i;
-
-    if (!i2c_start_wait((addr << 1) | I2C_WRITE))
-        goto fail;
-
-    if (!i2c_byte_out(reg))
-        goto fail;
-
-    for (i = 0; i < len; i++)
-    {
-        if (!i2c_byte_out(*(data + i)))
-            goto fail;
-    }
-
-    return i2c_wait_stop();
-fail:
-    i2c_wait_stop();
-    return false;
+    return i2c_transfer(addr, reg, data, len, 0);
 }
 
 bool i2c_read_buf(uint8_t addr, uint8_t reg, uint8_t *ret, uint8_t len)
 {
-    if (!i2c_start_wait(addr << 1 | I2C_WRITE))
-        goto fail;
-
-    if (!i2c_byte_out(reg))
-        goto fail;
-
-    if (!i2c_start_wait((addr << 1 | I2C_READ)))
-        goto fail;
-
-    while (len > 1)
-    {
-        if (!i2c_read_ack(ret))
-            goto fail;
-                
-        ret++;
-        len--;
-    }
-
-    if (!i2c_read_nack(ret))
-        goto fail;
-
-    return i2c_wait_stop();
-fail:
-    i2c_wait_stop();
-    return false;
+    return i2c_transfer(addr, reg, ret, len, I2C_XFER_READ);
 }
 
 #endif /* _I2C_XFER_MANY_ */
@@ -284,45 +313,23 @@ fail:
 
 bool i2c_write16(uint8_t addr, uint8_t reg, uint16_t data)
 {
-    if (!i2c_start_wait((addr << 1) | I2C_WRITE))
-        goto fail;
-    
-    if (!i2c_byte_out(reg))
-        goto fail;
-
-    if (!i2c_byte_out(*((uint8_t *)&data + 1)))
-        goto fail;
-
-    if (!i2c_byte_out(*((uint8_t *)&data)))
-        goto fail;
-
-    return i2c_wait_stop();
-fail:
-    i2c_wait_stop();
-    return false;
+    uint8_t buf[2];
+
+    buf[0] = (uint8_t)(data >> 8);
+    buf[1] = (uint8_t)(data & 0xFF);
+
+    return i2c_transfer(addr, reg, buf, 2, 0);
 }
 
 bool i2c_read16(uint8_t addr, uint8_t reg, uint16_t *ret)
 {
-    if (!i2c_start_wait(addr << 1 | I2C_WRITE))
-        goto fail;
-
-    if (!i2c_byte_out(reg))
-        goto fail;
-
-    if (!i2c_start_wait((addr << 1 | I2C_READ)))
-        goto fail;
-
-    if (!i2c_read_ack((uint8_t *)ret + 1))
-        goto fail;
+    uint8_t buf[2];
 
-    if (!i2c_read_nack((uint8_t *)ret))
-        goto fail;
+    if (!i2c_transfer(addr, reg, buf, 2, I2C_XFER_READ))
+        return false;
 
-    return i2c_wait_stop();
-fail:
-    i2c_wait_stop();
-    return false;
+    *ret = (uint16_t)(buf[0] << 8 | buf[1]);
+    return true;
 }
 
 #endif /* _I2C_XFER_X16_ */
@@ -333,28 +340,18 @@ bool i2c_await_flag(uint8_t addr, uint8_t mask, uint8_t *ret, uint8_t attempts)
 {
     uint8_t status;
 
-    if (!i2c_start_wait((addr << 1) | I2C_READ))
-        goto fail;
-
-    while (attempts--)
+    // The read pointer stays on the status register, so poll it with plain reads
+    do
     {
-        if (!i2c_read_ack(&status))
-            goto fail;
+        if (!i2c_transfer(addr, 0, &status, 1, I2C_XFER_READ | I2C_XFER_NOREG))
+            return false;
 
         if (!(status & mask))
             break;
-    }
-
-    if (!i2c_read_nack(&status))
-        goto fail;
+    } while (attempts--);
 
-    i2c_wait_stop();
     *ret = status;
     return !(status & mask);
-
-fail:
-    i2c_wait_stop();
-    return false;
 }
 
 #endif /* _I2C_DS2482_SPECIAL_ */
@@ -21,7 +21,32 @@
 #ifndef __I2C_H__
 #define __I2C_H__
 
+#define I2C_XFER_READ       0x01    /* Read into buf (otherwise write from buf) */
+#define I2C_XFER_NOREG      0x02    /* No register byte. Plain read/write */
+#define I2C_XFER_PROBE      0x04    /* Address only. ACK/NACK, no retries */
+
+#define I2C_XFER_PENDING    0x00
+#define I2C_XFER_OK         0x01
+#define I2C_XFER_FAILED     0x02
+
+typedef struct i2c_xfer i2c_xfer_t;
+
+struct i2c_xfer
+{
+    uint8_t addr;
+    uint8_t reg;
+    uint8_t *buf;
+    uint8_t len;
+    uint8_t flags;
+    volatile uint8_t status;
+    void (*callback)(i2c_xfer_t *xfer);
+    void *data;
+};
+
 void i2c_init(uint16_t freq_khz);
+bool i2c_submit(i2c_xfer_t *xfer);
+void i2c_process(void);
+bool i2c_probe(uint8_t addr);
 
 #ifdef _I2C_BRUTEFORCE_RESET_
 void i2c_bruteforce_reset(void);
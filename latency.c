@@ -0,0 +1,151 @@
+/*
+ *   File:   latency.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 21:12
+ *
+ *   Worst case time in each ISR and with interrupts off, and how late the
+ *   1 ms tick gets serviced. Together they bound how long a received
+ *   character can wait, which is what decides if a baud rate is safe.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "latency.h"
+#include "timeout.h"
+
+#ifdef _LATENCY_
+
+#define LATENCY_ENTRY_EXIT_US   6   // Register saves and restores of one ISR, at worst
+#define LATENCY_RX_BITS         20  // The UART holds two 8N1 characters before overrunning
+
+volatile latency_t _g_latency;
+
+static uint16_t _g_irq_off_start;
+static bool _g_irq_off_pending;    // Timer1 compare was already waiting
+static bool _g_irq_off_open;
+
+/*
+ * Stand in for cli() and sei() (see project.h). Only windows opened with
+ * interrupts on are timed; a disable inside one is part of it.
+ */
+void latency_irq_disable(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+
+    if (!(sreg & _BV(SREG_I)))
+        return;
+
+    _g_irq_off_start = TCNT1;
+    _g_irq_off_pending = (TIFR1 & _BV(OCF1A)) != 0;
+    _g_irq_off_open = true;
+}
+
+void latency_irq_enable(void)
+{
+    if (_g_irq_off_open) {
+        uint16_t end = TCNT1;
+        uint16_t counts;
+
+        if (end >= _g_irq_off_start)
+            counts = end - _g_irq_off_start;
+        else
+            counts = end + OCR1A + 1 - _g_irq_off_start;
+
+        // A compare that came up while off, with TCNT1 past where it was,
+        // means Timer1 has been all the way round
+        if (!_g_irq_off_pending && TIFR1 & _BV(OCF1A) && end >= _g_irq_off_start)
+            counts = LATENCY_OVER;
+
+        if (counts > _g_latency.irq_off_max)
+            _g_latency.irq_off_max = counts;
+
+        _g_irq_off_open = false;
+    }
+
+    sei();
+}
+
+void latency_reset(void)
+{
+    g_irq_disable();
+    memset((void *)&_g_latency, 0, sizeof(_g_latency));
+    g_irq_enable();
+}
+
+static uint16_t latency_us(uint16_t counts)
+{
+    return get_stamp_us(0, counts);
+}
+
+void latency_report(uint32_t baud)
+{
+    latency_t l;
+    uint16_t worst = 0;
+    uint16_t wait;
+    uint16_t budget = 1000000UL * LATENCY_RX_BITS / baud;
+    uint8_t i;
+
+    g_irq_disable();
+    memcpy(&l, (void *)&_g_latency, sizeof(l));
+    g_irq_enable();
+
+    printf("Times in us. ISRs leave out entry and exit, up to %u us each\r\n\r\n", LATENCY_ENTRY_EXIT_US);
+    printf("Longest ISR      : timer %u, rx %u, udre %u, twi %u\r\n",
+        latency_us(l.isr_max[LATENCY_TIMER1]), latency_us(l.isr_max[LATENCY_RX]),
+        latency_us(l.isr_max[LATENCY_UDRE]), latency_us(l.isr_max[LATENCY_TWI]));
+
+    if (l.irq_off_max == LATENCY_OVER) {
+        printf("Longest irqs off : over 1000\r\n");
+    } else {
+        printf("Longest irqs off : %u\r\n", latency_us(l.irq_off_max));
+    }
+
+    printf("Tick lateness    : max %u, mean %u. %u of %lu over 100\r\n\r\n",
+        latency_us(l.tick_max), l.ticks ? latency_us(l.tick_sum / l.ticks) : 0,
+        l.ticks_late, l.ticks);
+
+    if (l.irq_off_max == LATENCY_OVER) {
+        printf("Interrupts have been off for a whole tick. No rate is safe\r\n");
+        return;
+    }
+
+    // Whatever is running or has interrupts off finishes first. Then the
+    // timer, the only higher priority vector, may go ahead of RX
+    for (i = 0; i < LATENCY_ISRS; i++) {
+        if (l.isr_max[i] > worst)
+            worst = l.isr_max[i];
+    }
+
+    if (l.irq_off_max > worst)
+        worst = l.irq_off_max;
+
+    wait = latency_us(worst) + latency_us(l.isr_max[LATENCY_TIMER1]) + 2 * LATENCY_ENTRY_EXIT_US;
+
+    printf("RX can wait up to %u us. Safe up to %lu baud\r\n", wait, 1000000UL * LATENCY_RX_BITS / wait);
+    printf("At %lu baud the UART holds %u us: %s\r\n", baud, budget, wait < budget ? "OK" : "AT RISK");
+}
+
+#endif /* _LATENCY_ */
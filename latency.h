@@ -0,0 +1,101 @@
+/*
+ *   File:   latency.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 21:12
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#define LATENCY_TIMER1      0
+#define LATENCY_RX          1
+#define LATENCY_UDRE        2
+#define LATENCY_TWI         3
+#define LATENCY_ISRS        4
+
+#define LATENCY_OVER        0xFFFF  // Interrupts were off for more than a tick
+
+#ifdef _LATENCY_
+
+#define LATENCY_LATE        184     // Timer1 counts, 100 us. Ticks later than this are counted
+
+typedef struct {
+    uint16_t isr_max[LATENCY_ISRS]; // All in Timer1 counts
+    uint16_t irq_off_max;
+    uint16_t tick_max;
+    uint16_t ticks_late;
+    uint32_t tick_sum;  // Halved with ticks when it gets to half full
+    uint32_t ticks;
+} latency_t;
+
+typedef struct {
+    uint16_t start;     // TCNT1
+    uint8_t isr;
+} latency_isr_t;
+
+extern volatile latency_t _g_latency;
+
+/*
+ * Timer1 counts from here to wherever the ISR returns. Entry and exit
+ * (the register saves) aren't included.
+ */
+#define LATENCY_ISR(isr) \
+    latency_isr_t _latency __attribute__((cleanup(latency_isr_end))) = { TCNT1, (isr) }
+
+// The Timer1 ISR only. TCNT1 restarted at the compare match, so where it
+// is on entry is how late the tick is
+#define LATENCY_TICK() \
+    LATENCY_ISR(LATENCY_TIMER1); \
+    latency_tick(_latency.start)
+
+// Both inline, as a call from an ISR makes it save every register
+static inline void latency_isr_end(latency_isr_t *l)
+{
+    uint16_t end = TCNT1;
+    uint16_t counts = end >= l->start ? end - l->start : end + OCR1A + 1 - l->start;
+
+    if (counts > _g_latency.isr_max[l->isr])
+        _g_latency.isr_max[l->isr] = counts;
+}
+
+static inline void latency_tick(uint16_t late)
+{
+    if (late > _g_latency.tick_max)
+        _g_latency.tick_max = late;
+    if (late > LATENCY_LATE && _g_latency.ticks_late != 0xFFFF)
+        _g_latency.ticks_late++;
+
+    if (_g_latency.tick_sum & 0x80000000) {
+        _g_latency.tick_sum >>= 1;
+        _g_latency.ticks >>= 1;
+    }
+
+    _g_latency.tick_sum += late;
+    _g_latency.ticks++;
+}
+
+void latency_reset(void);
+void latency_report(uint32_t baud);
+
+#else
+
+#define LATENCY_ISR(isr)
+#define LATENCY_TICK()
+
+#endif /* _LATENCY_ */
+
+#endif /* __LATENCY_H__ */
@@ -25,7 +25,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <util/delay.h>
 #include <avr/io.h>
 #include <avr/wdt.h> 
 #include <avr/pgmspace.h>
@@ -40,9 +39,28 @@
 #include "lcd.h"
 #include "fnppsu.h"
 #include "timeout.h"
+#include "sampler.h"
+#include "energy.h"
+#include "stats.h"
+#include "task.h"
+#include "modbus.h"
+#include "perf.h"
 
 #define MAX_DESC           8
 #define PS_ON_DELAY_MS     500
+#define PS_CYCLE_MS        500 // Off time when a set voltage change needs the output cycled
+
+/*
+ * Discovery task state. Only the PSU being looked at is ever in RAM; the
+ * rest of the inventory stays in EEPROM.
+ */
+typedef struct {
+    bool rescan;        // Skip verifying the stored list
+    uint8_t known;      // PSUs in the stored list
+    uint8_t idx;
+    uint8_t addr;       // Next address to scan
+    uint32_t start;
+} psu_discovery_t;
 
 char _g_dotBuf[MAX_DESC];
 
@@ -51,10 +69,31 @@ sys_runstate_t _g_rs;
 
 FILE uart_str = FDEV_SETUP_STREAM(print_char, NULL, _FDEV_SETUP_RW);
 
+static bool _g_adjusting;       // A set voltage change is in flight
+static uint8_t _g_hitless_mask;
+static uint16_t _g_hitless_sv;
+static uint8_t _g_hitless_unsettled; // PSUs whose output hasn't followed the step yet
+static uint8_t _g_hitless_tries;
+static int8_t _g_hitless_timer = -1;
+
+static task_t _g_psu_task;      // Power up or rescan. Never both at once
+static task_t _g_discover_task; // Spawned by either
+static task_t _g_cycle_task;
+static psu_discovery_t _g_discovery;
+
 static void io_init(void);
 static void update_lcd(void *param);
 static bool psu_init(sys_runstate_t *rs);
-static uint8_t psu_find(uint8_t *addrs);
+static uint8_t psu_discover_task(task_t *t);
+static bool psu_verify(uint8_t idx, uint8_t *addr);
+static bool psu_known(const uint8_t *addrs, uint8_t num, uint8_t addr);
+static bool psu_probe(uint8_t idx, uint8_t addr);
+static void psu_adjust_done(uint8_t mask, uint8_t failed, void *data);
+static bool psu_hitless_step(sys_runstate_t *rs);
+static void psu_hitless_done(uint8_t mask, uint8_t failed, void *data);
+static void psu_hitless_settled(void *param);
+static void psu_hitless_fallback(sys_runstate_t *rs, uint8_t failed);
+static void psu_adjust_finished(sys_runstate_t *rs);
 
 int main(void)
 {
@@ -66,35 +105,59 @@ int main(void)
     io_init();
     wdt_enable(WDTO_1S);
     g_irq_enable();
+    timeout_init();
     i2c_init(400);
 
-    usart1_open(USART_CONT_RX, (((F_CPU / UART1_BAUD) / 16) - 1));
+    usart1_open(USART_CONT_RX, UART1_BRG(UART1_BAUD));
     stdout = &uart_str;
 
+    // Anything printed in here is about falling back to defaults, so it
+    // goes out at the default rate
+    load_configuration(rs->config);
+
+    usart1_set_brg(UART1_BRG(rs->config->baud));
+    usart1_set_flow_control(rs->config->flow_control);
+
     printf("\r\nStarting up...\r\n");
 
     lcd_init();
 
-    load_configuration(rs->config);
-
-    if (rs->config->start_mode)
-        psu_init(rs);
-    else
+    if (rs->config->start_mode) {
+        psu_init(rs); // Carries on from the idle loop
+    } else {
         printf("Output disabled. Not probing attached power supplies\r\n");
+        printf("Found %u of max %u attached power supplies\r\n", rs->psu_num, MAX_PSU);
+    }
 
-    printf("Found %u of max %u attached power supplies\r\n", rs->psu_num, MAX_PSU);
-
-    timeout_init();
     timeout_create(500, true, true, &update_lcd, (void *)rs);
+    energy_init();
+#ifdef _STATS_
+    stats_init();
+#endif /* _STATS_ */
+#ifdef _PERF_
+    perf_reset();
+#endif /* _PERF_ */
+    sampler_init(rs);
 
     cmd_init();
 
+#ifdef _MODBUS_
+    if (rs->config->modbus_addr) {
+        printf("Starting Modbus RTU slave at address %u\r\n", rs->config->modbus_addr);
+        modbus_start(rs);
+    }
+#endif /* _MODBUS_ */
+
     // Idle loop
     for (;;) {
-        timeout_check();
-        cmd_process(rs);
-        lcd_process();
+        PERF_BEGIN(PERF_LOOP);
+        PERF_RUN(PERF_TIMEOUT, timeout_check());
+        PERF_RUN(PERF_TASK, task_run());
+        PERF_RUN(PERF_I2C, i2c_process());
+        PERF_RUN(PERF_CMD, cmd_process(rs));
+        PERF_RUN(PERF_LCD, lcd_process());
         CLRWDT();
+        PERF_END(PERF_LOOP);
     }
 }
 
@@ -106,71 +169,238 @@ static void psu_enable(bool enable)
 
         printf("Enabling output...\r\n");
         PS_ON_PORT &= ~_BV(PS_ON); // On
+        sampler_reset(); // Anything in there predates the output coming on
     } else {
         if (!PS_ON_STATE)
             return;
 
         printf("Disabling output...\r\n");
         PS_ON_PORT |= _BV(PS_ON); // Off
+        energy_checkpoint(); // Nothing more to count for a while
     }
 }
 
-static bool psu_init(sys_runstate_t *rs)
+static uint8_t psu_init_task(task_t *t)
 {
+    sys_runstate_t *rs = (sys_runstate_t *)t->data;
+
+    TASK_BEGIN(t);
+
     psu_enable(true);
-    _delay_ms(PS_ON_DELAY_MS);
-    CLRWDT();
+    TASK_WAIT_MS(t, PS_ON_DELAY_MS);
+
+    if (!PS_ON_STATE)
+        TASK_EXIT(t); // Switched off while waiting. Nothing to find
 
-    rs->psu_num = psu_find(rs->psu_addrs);
+    _g_discovery.rescan = false;
+    TASK_SPAWN(t, &_g_discover_task, &psu_discover_task, rs);
 
     if (rs->config->expected_psus && rs->psu_num < rs->config->expected_psus) {
         printf("Error: Number of power supplies detected (%u) does not match expected number (%u)\r\n",
             rs->psu_num, rs->config->expected_psus);
         psu_enable(false);
-        return false;
+        TASK_EXIT(t);
+    }
+
+    if (!PS_ON_STATE) {
+        // Switched off during discovery. Set it when it next comes on
+        rs->outvoltage_stale = true;
+        TASK_EXIT(t);
     }
 
     psu_adjust_voltages(rs);
-    return rs->psu_num > 0;
+
+    TASK_END(t);
 }
 
-static uint8_t psu_find(uint8_t *addrs)
+/*
+ * Switches on, waits for the PSUs to come up, then finds them and sets
+ * their voltage, all from the idle loop. False if already under way.
+ */
+static bool psu_init(sys_runstate_t *rs)
+{
+    if (!task_start(&_g_psu_task, &psu_init_task, (void *)rs)) {
+        printf("Error: Power up or rescan already in progress\r\n");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Verifies the stored list if it's good enough, then probes the addresses
+ * not on it. Otherwise scans the bus. One PSU or address per step.
+ * rs->psu_num stays at 0 until the end, so the sampler leaves the bus
+ * alone meanwhile.
+ */
+static uint8_t psu_discover_task(task_t *t)
 {
-    uint8_t addr;
-    uint8_t idx = 0;
+    sys_runstate_t *rs = (sys_runstate_t *)t->data;
+    psu_discovery_t *d = &_g_discovery;
+
+    TASK_BEGIN(t);
 
     printf("\r\n");
 
-    for (addr = FNPPSU_I2C_ADDR_MIN; addr <= FNPPSU_I2C_ADDR_MAX; addr++) {
-        fnppsu_dev_info_t info;
+    rs->psu_num = 0;
+    d->start = get_tick_count();
+    fnppsu_cache_clear();
 
-        if (idx >= MAX_PSU) {
-            printf("Maximum number of supported power supplies found. Aborting\r\n");
-            return idx;
+    if (!d->rescan && load_inventory_count(&d->known) && d->known &&
+            d->known >= rs->config->expected_psus) {
+        for (d->idx = 0; d->idx < d->known; d->idx++) {
+            if (!psu_verify(d->idx, &rs->psu_addrs[d->idx]))
+                break;
+            TASK_YIELD(t);
         }
 
-        if (fnppsu_get_dev_info(addr, &info)) {
-            printf("Detected PSU @ 0x%02X\r\n", addr);
-            printf("Manufacturer     : %s\r\n", info.mfg);
-            printf("Model            : %s\r\n", info.model);
-            printf("Serial           : %s\r\n", info.serial);
-            printf("Rev              : %s\r\n", info.rev);
-            printf("Mfg. Date        : %u.%u.%u\r\n", info.mfg_year, info.mfg_month, info.mfg_day);
-            printf("Hours in service : %lu\r\n\r\n", info.hours_in_service);
+        if (d->idx == d->known) {
+            printf("Known power supplies verified. Use 'inventory' for details\r\n");
 
-            addrs[idx++] = addr;
+            // Only an ACK check for most, so a PSU added since is still found
+            for (d->addr = FNPPSU_I2C_ADDR_MIN; d->addr <= FNPPSU_I2C_ADDR_MAX && d->idx < MAX_PSU; d->addr++) {
+                if (!psu_known(rs->psu_addrs, d->known, d->addr) && psu_probe(d->idx, d->addr))
+                    rs->psu_addrs[d->idx++] = d->addr;
+
+                TASK_YIELD(t);
+            }
+
+            if (d->idx > d->known)
+                save_inventory_count(d->idx);
+
+            rs->psu_num = d->idx;
+            goto done;
         }
+    }
 
-        CLRWDT();
+    printf("Scanning for power supplies...\r\n");
+
+    fnppsu_cache_clear();
+    save_inventory_count(0); // Until the scan is complete
+
+    for (d->idx = 0, d->addr = FNPPSU_I2C_ADDR_MIN; d->addr <= FNPPSU_I2C_ADDR_MAX; d->addr++) {
+        if (d->idx >= MAX_PSU) {
+            printf("Maximum number of supported power supplies found. Aborting\r\n");
+            break;
+        }
+
+        if (psu_probe(d->idx, d->addr))
+            rs->psu_addrs[d->idx++] = d->addr;
+
+        TASK_YIELD(t);
+    }
+
+    save_inventory_count(d->idx);
+    rs->psu_num = d->idx;
+
+    printf("Bus scan took %lu ms\r\n", (get_tick_count() - d->start) * TIMEOUT_MS_PER_TICK);
+
+done:
+    printf("Found %u of max %u attached power supplies\r\n", rs->psu_num, MAX_PSU);
+
+    TASK_END(t);
+}
+
+static uint8_t psu_rescan_task(task_t *t)
+{
+    sys_runstate_t *rs = (sys_runstate_t *)t->data;
+
+    TASK_BEGIN(t);
+
+    _g_discovery.rescan = true;
+    TASK_SPAWN(t, &_g_discover_task, &psu_discover_task, rs);
+
+    sampler_reset();
+#ifdef _STATS_
+    stats_reset(true); // Indexes may now be different PSUs
+#endif /* _STATS_ */
+
+    if (rs->psu_num && PS_ON_STATE)
+        psu_adjust_voltages(rs);
+
+    TASK_END(t);
+}
+
+bool psu_rescan(sys_runstate_t *rs)
+{
+    if (!task_start(&_g_psu_task, &psu_rescan_task, (void *)rs)) {
+        printf("Error: Power up or rescan already in progress\r\n");
+        return false;
     }
 
-    return idx;
+    return true;
+}
+
+/*
+ * Checks PSU idx of the stored inventory is still there, and is the same
+ * one. Fills in its address.
+ */
+static bool psu_verify(uint8_t idx, uint8_t *addr)
+{
+    char stored[FNPPSU_MAX_SERIAL];
+    char serial[FNPPSU_MAX_SERIAL + 1];
+
+    load_inventory_psu(idx, addr, stored);
+
+    if (!i2c_probe(*addr) || !fnppsu_get_serial(*addr, serial) ||
+            strncmp(serial, stored, FNPPSU_MAX_SERIAL)) {
+        printf("PSU @ 0x%02X does not match the stored inventory\r\n", *addr);
+        return false;
+    }
+
+    fnppsu_cache_fill(*addr);
+    printf("Detected PSU @ 0x%02X (%s)\r\n", *addr, serial);
+
+    return true;
+}
+
+static bool psu_known(const uint8_t *addrs, uint8_t num, uint8_t addr)
+{
+    uint8_t i;
+
+    for (i = 0; i < num; i++) {
+        if (addrs[i] == addr)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Stores whatever answers at addr as inventory entry idx.
+ */
+static bool psu_probe(uint8_t idx, uint8_t addr)
+{
+    char serial[FNPPSU_MAX_SERIAL + 1];
+    char stored[FNPPSU_MAX_SERIAL];
+
+    // Only bother with the identity read if something answers
+    if (!i2c_probe(addr) || !fnppsu_get_serial(addr, serial))
+        return false;
+
+    fnppsu_cache_fill(addr);
+    printf("Detected PSU @ 0x%02X (%s)\r\n", addr, serial);
+
+    strncpy(stored, serial, FNPPSU_MAX_SERIAL);
+    save_inventory_psu(idx, addr, stored);
+
+    return true;
 }
 
 bool psu_adjust_voltages(sys_runstate_t *rs)
 {
     uint8_t i;
-    bool adjusted = false;
+    uint8_t mask = 0;
+    uint16_t from = 0;
+    bool agree = true;
+    bool ret;
+
+    if (_g_adjusting) {
+        // Picked up by psu_adjust_finished()
+        printf("Set voltage change queued behind the one in progress\r\n");
+        rs->outvoltage_stale = true;
+        return true;
+    }
 
     for (i = 0; i < rs->psu_num; i++) {
         uint8_t addr = rs->psu_addrs[i];
@@ -185,47 +415,254 @@ bool psu_adjust_voltages(sys_runstate_t *rs)
             printf("Changing set voltage for PSU @ 0x%02X from %u.%02u to %u.%02u\r\n",
                 addr, fixedpoint_arg_u_2dp(sv), fixedpoint_arg_u_2dp(rs->config->output_voltage));
 
-            if (!fnppsu_output1_write_set_voltage(addr, rs->config->output_voltage)) {
-                printf("Error changing set voltage on PSU @ 0x%02X\r\n", addr);
-                return false;
-            }
-
-            adjusted = true;
+            if (!mask)
+                from = sv;
+            else if (sv != from)
+                agree = false;
+            mask |= _BV(i);
         }
     }
 
-    if (adjusted) {
-        psu_enable(false);
-        for (i = 0; i < 5; i++) {
-            _delay_ms(100);
-            CLRWDT();
+    if (!mask)
+        return true;
+
+    if (rs->config->hitless && PS_ON_STATE && !agree)
+        printf("PSUs are at different set voltages. Cycling output to change them\r\n");
+
+    if (rs->config->hitless && PS_ON_STATE && agree) {
+        // All step together from where they are now. Completes in psu_hitless_done()
+        _g_hitless_mask = mask;
+        _g_hitless_sv = from;
+        ret = psu_hitless_step(rs);
+    } else {
+        // Completes in psu_adjust_done()
+        ret = fnppsu_output1_write_set_voltage_fleet(rs->psu_addrs, mask, rs->config->output_voltage, 0,
+            &psu_adjust_done, (void *)rs);
+    }
+
+    if (!ret)
+        printf("Error: Set voltage change already in progress\r\n");
+
+    _g_adjusting = ret;
+    return ret;
+}
+
+// True if going from a to b changes the set voltage MSB (256 mV bands)
+static bool psu_hitless_crosses(uint16_t a, uint16_t b)
+{
+    return ((a * 10) >> 8) != ((b * 10) >> 8);
+}
+
+/*
+ * Raising writes the LSB first and lowering the MSB first, so the half
+ * written set point is never above the higher of the old and new ones.
+ * Within a 256 mV band only the LSB changes and there is no transient.
+ * Across a band boundary it dips 256 mV less the step below the lower
+ * one: 6 mV for a full step, but most of 256 for a short one. So the one
+ * short step in a change is taken first or last, whichever of the two
+ * stays inside a band.
+ */
+static bool psu_hitless_step(sys_runstate_t *rs)
+{
+    uint16_t target = rs->config->output_voltage;
+    uint16_t left;
+    uint16_t step;
+    uint8_t flags = 0;
+
+    if (target > _g_hitless_sv) {
+        left = target - _g_hitless_sv;
+        flags = FNPPSU_FLEET_LSB_FIRST;
+    } else {
+        left = _g_hitless_sv - target;
+    }
+
+    step = min_(left, HITLESS_MAX_STEP);
+
+    if (left > HITLESS_MAX_STEP && left < 2 * HITLESS_MAX_STEP) {
+        uint16_t rem = left - HITLESS_MAX_STEP;
+        uint16_t last = (flags & FNPPSU_FLEET_LSB_FIRST) ? target - rem : target + rem;
+        uint16_t first = (flags & FNPPSU_FLEET_LSB_FIRST) ? _g_hitless_sv + rem : _g_hitless_sv - rem;
+
+        if (psu_hitless_crosses(last, target) && !psu_hitless_crosses(_g_hitless_sv, first))
+            step = rem;
+    }
+
+    if (flags & FNPPSU_FLEET_LSB_FIRST)
+        _g_hitless_sv += step;
+    else
+        _g_hitless_sv -= step;
+
+    return fnppsu_output1_write_set_voltage_fleet(rs->psu_addrs, _g_hitless_mask, _g_hitless_sv, flags,
+        &psu_hitless_done, (void *)rs);
+}
+
+static void psu_hitless_done(uint8_t mask, uint8_t failed, void *data)
+{
+    sys_runstate_t *rs = (sys_runstate_t *)data;
+
+    if (failed) {
+        psu_hitless_fallback(rs, failed);
+        return;
+    }
+
+    // The set point read back fine. Give the output time to follow it.
+    if (_g_hitless_timer < 0) {
+        _g_hitless_timer = timeout_create(HITLESS_SETTLE_MS, false, false, &psu_hitless_settled, (void *)rs);
+        if (_g_hitless_timer < 0) {
+            psu_hitless_fallback(rs, mask);
+            return;
         }
-        psu_enable(true);
     }
 
-    return true;
+    _g_hitless_unsettled = mask;
+    _g_hitless_tries = 0;
+    timeout_start(_g_hitless_timer);
+}
+
+static void psu_hitless_settled(void *param)
+{
+    sys_runstate_t *rs = (sys_runstate_t *)param;
+    uint8_t i;
+
+    for (i = 0; i < rs->psu_num; i++) {
+        fnppsu_telemetry_t telem;
+
+        if (!(_g_hitless_unsettled & _BV(i)))
+            continue;
+
+        if (fnppsu_output1_read_telemetry(rs->psu_addrs[i], &telem) &&
+                telem.volts <= _g_hitless_sv + HITLESS_TOLERANCE &&
+                telem.volts + HITLESS_TOLERANCE >= _g_hitless_sv)
+            _g_hitless_unsettled &= ~_BV(i);
+    }
+
+    if (_g_hitless_unsettled) {
+        if (++_g_hitless_tries < HITLESS_RETRIES)
+            timeout_start(_g_hitless_timer);
+        else
+            psu_hitless_fallback(rs, _g_hitless_unsettled);
+        return;
+    }
+
+    if (_g_hitless_sv != rs->config->output_voltage) {
+        if (!psu_hitless_step(rs))
+            psu_adjust_finished(rs);
+        return;
+    }
+
+    printf("Set voltage changed to %u.%02u without switching off\r\n",
+        fixedpoint_arg_u_2dp(rs->config->output_voltage));
+    psu_adjust_finished(rs);
+}
+
+static void psu_hitless_fallback(sys_runstate_t *rs, uint8_t failed)
+{
+    uint8_t i;
+
+    for (i = 0; i < rs->psu_num; i++) {
+        if (failed & _BV(i))
+            printf("PSU @ 0x%02X refused a live set voltage change\r\n", rs->psu_addrs[i]);
+    }
+
+    // Fall back to the old way. psu_adjust_done() cycles the output.
+    if (!fnppsu_output1_write_set_voltage_fleet(rs->psu_addrs, _g_hitless_mask, rs->config->output_voltage, 0,
+            &psu_adjust_done, (void *)rs)) {
+        printf("Error: Set voltage change already in progress\r\n");
+        psu_adjust_finished(rs);
+    }
+}
+
+static uint8_t psu_cycle_task(task_t *t)
+{
+    sys_runstate_t *rs = (sys_runstate_t *)t->data;
+
+    TASK_BEGIN(t);
+
+    psu_enable(false);
+    TASK_WAIT_MS(t, PS_CYCLE_MS);
+    psu_change_state(rs, true); // Applies anything queued meanwhile
+
+    TASK_END(t);
+}
+
+static void psu_adjust_done(uint8_t mask, uint8_t failed, void *data)
+{
+    sys_runstate_t *rs = (sys_runstate_t *)data;
+    uint8_t i;
+
+    for (i = 0; i < rs->psu_num; i++) {
+        if (failed & _BV(i))
+            printf("Error changing set voltage on PSU @ 0x%02X\r\n", rs->psu_addrs[i]);
+    }
+
+    // Off means it lands when it next comes on. Already cycling means it
+    // lands when that comes back on.
+    if (mask != failed && PS_ON_STATE)
+        task_start(&_g_cycle_task, &psu_cycle_task, (void *)rs);
+
+    psu_adjust_finished(rs);
+}
+
+/*
+ * End of a set voltage change. Starts the next one if the target moved
+ * while this was in flight. A cycle does that when it comes back on.
+ */
+static void psu_adjust_finished(sys_runstate_t *rs)
+{
+    _g_adjusting = false;
+
+    if (rs->outvoltage_stale && PS_ON_STATE && rs->psu_num && !task_running(&_g_cycle_task)) {
+        rs->outvoltage_stale = false;
+        psu_adjust_voltages(rs);
+    }
 }
 
 bool psu_change_state(sys_runstate_t *rs, bool on)
 {
     if (on) {
-        if (!PS_ON_STATE && !rs->psu_num)
+        if (task_running(&_g_psu_task) && _g_psu_task.fn == &psu_init_task)
+            psu_enable(true); // Switched off part way through. Carry on
+        else if (!PS_ON_STATE && !rs->psu_num)
             return psu_init(rs);
         else if (!PS_ON_STATE && rs->psu_num) {
             psu_enable(true);
             if (rs->outvoltage_stale) {
+                rs->outvoltage_stale = false; // Before, as a queued change sets it again
                 psu_adjust_voltages(rs);
-                rs->outvoltage_stale = false;
             }
         }
     }
     else {
+        // A cycle would switch it back on. A power up checks for itself
+        task_stop(&_g_cycle_task);
         psu_enable(false);
     }
 
     return true;
 }
 
+/*
+ * For the host protocols. Stores a new output voltage and applies it now
+ * if the output is on, or the next time it comes on.
+ */
+bool psu_set_output_voltage(sys_runstate_t *rs, uint16_t volts)
+{
+    if (volts < OUTPUT_VOLTAGE_MIN || volts > OUTPUT_VOLTAGE_MAX)
+        return false;
+
+    if (volts == rs->config->output_voltage && !rs->outvoltage_stale)
+        return true;
+
+    rs->config->output_voltage = volts;
+    save_configuration(rs->config);
+
+    if (PS_ON_STATE && rs->psu_num)
+        return psu_adjust_voltages(rs);
+
+    rs->outvoltage_stale = true;
+    return true;
+}
+
 static void io_init(void)
 {
     PS_ON_PORT |= _BV(PS_ON); // Off
@@ -235,35 +672,30 @@ static void io_init(void)
 static void update_lcd(void *param)
 {
     sys_runstate_t *rs = (sys_runstate_t *)param;
-    uint16_t display_voltage = 0;
-    uint16_t total_amps = 0;
-    int len;
+    psu_totals_t totals;
+    PERF_SCOPE(PERF_UPDATE_LCD);
+
+    if (task_running(&_g_psu_task)) {
+        strcpy_p(_g_lcd_data[LCD_ROW1], "SCANNING");
+        strcpy_p(_g_lcd_data[LCD_ROW2], "");
+        goto done;
+    }
 
     if (PS_ON_STATE && rs->psu_num) {
         for (uint8_t i = 0; i < rs->psu_num; i++) {
-            uint16_t volts;
-            uint16_t amps;
-            uint8_t addr = rs->psu_addrs[i];
-
-            if (rs->config->show_measured_volts) {
-                if (!fnppsu_output1_read_meas_voltage(addr, &volts)) {
-                    printf("Error reading voltage from PSU @ 0x%02X\r\n", addr);
-                    goto i2cerror;
-                }
-            }
-            if (!fnppsu_output1_read_meas_current(addr, &amps)) {
-                printf("Error reading current from PSU @ 0x%02X\r\n", addr);
+            psu_sample_t *sample = &_g_samples[i];
+
+            if (sample->flags & SAMPLE_ERROR)
                 goto i2cerror;
-            }
 
-            display_voltage += volts;
-            total_amps += amps;
+            if (!(sample->flags & SAMPLE_VALID))
+                return; // Sampler hasn't been round yet
         }
 
-        if (rs->config->show_measured_volts)
-            display_voltage /= rs->psu_num;
-        else
-            display_voltage = rs->config->output_voltage;
+        sampler_totals(rs->psu_num, &totals);
+
+        if (!rs->config->show_measured_volts)
+            totals.avg_volts = rs->config->output_voltage;
         
         memset(_g_lcd_data[LCD_ROW1], 0x20, LCD_COLS);
         memset(_g_lcd_data[LCD_ROW2], 0x20, LCD_COLS);
@@ -271,11 +703,9 @@ static void update_lcd(void *param)
         _g_lcd_data[LCD_ROW1][LCD_COLS - 1] = 'V';
         _g_lcd_data[LCD_ROW2][LCD_COLS - 1] = 'A';
 
-        len = sprintf(_g_lcd_data[LCD_ROW1], "%u.%02u", fixedpoint_arg_u_2dp(display_voltage));
-        _g_lcd_data[LCD_ROW1][len] = 0x20; // Remove null terminator
-
-        len = sprintf(_g_lcd_data[LCD_ROW2], "%u.%02u", fixedpoint_arg_u_2dp(total_amps));
-        _g_lcd_data[LCD_ROW2][len] = 0x20; // Remove null terminator
+        // Straight over the spaces, no terminator to clean up after
+        format_2dp(_g_lcd_data[LCD_ROW1], totals.avg_volts, 0);
+        format_2dp(_g_lcd_data[LCD_ROW2], totals.amps, 0); // Up to 9999.99 fits
 
         goto done;
     }
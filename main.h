@@ -30,6 +30,8 @@ typedef struct
 } sys_runstate_t;
 
 bool psu_adjust_voltages(sys_runstate_t *rs);
+bool psu_rescan(sys_runstate_t *rs);
 bool psu_change_state(sys_runstate_t *rs, bool on);
+bool psu_set_output_voltage(sys_runstate_t *rs, uint16_t volts);
 
 #endif /* __MAIN_H__ */
@@ -0,0 +1,81 @@
+/*
+ *   File:   mem.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 21:13
+ *
+ *   RAM use. Everything between the statics and the top of RAM is painted
+ *   at reset, so how deep the stack has been is wherever the paint stops.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+
+#include "mem.h"
+
+// From the avr-libc linker script
+extern uint8_t __data_start;
+extern uint8_t __data_end;
+extern uint8_t __bss_start;
+extern uint8_t __bss_end;
+extern uint8_t _end;    // After .noinit too. Nothing here uses the heap
+extern uint8_t __stack; // RAMEND
+
+/*
+ * Runs before anything else, before even r1 is cleared and the stack
+ * pointer set, so it's assembler and can't be called. .bss is cleared
+ * after this, but that's all below _end.
+ */
+void mem_paint(void) __attribute__((naked, used, section(".init1")));
+
+void mem_paint(void)
+{
+    __asm volatile (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "i" (MEM_PAINT)
+    );
+}
+
+void mem_usage(mem_usage_t *usage)
+{
+    uint8_t *sp = (uint8_t *)SP;
+    uint8_t *p = &_end;
+
+    // Lowest unpainted byte. A pushed byte could match the paint by
+    // chance, so this can be a byte or two shallow
+    while (p <= sp && *p == MEM_PAINT)
+        p++;
+
+    usage->data = &__data_end - &__data_start;
+    usage->bss = &__bss_end - &__bss_start;
+    usage->free = sp - &_end + 1;
+    usage->stack = &__stack - sp;
+    usage->stack_max = &__stack - p + 1;
+    usage->sp_min = (uint16_t)p - 1;
+    usage->untouched = p - &_end;
+}
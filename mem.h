@@ -0,0 +1,38 @@
+/*
+ *   File:   mem.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 21:13
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MEM_H__
+#define __MEM_H__
+
+#define MEM_PAINT           0xC5    // Free RAM is filled with this at reset
+
+typedef struct {
+    uint16_t data;      // Initialised statics
+    uint16_t bss;       // Zeroed statics
+    uint16_t free;      // Between the statics and the stack, now
+    uint16_t stack;     // In use now
+    uint16_t stack_max; // Deepest the stack has been since reset
+    uint16_t sp_min;    // Lowest stack pointer seen
+    uint16_t untouched; // Never reached by the stack. What's really spare
+} mem_usage_t;
+
+void mem_usage(mem_usage_t *usage);
+
+#endif /* __MEM_H__ */
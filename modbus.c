@@ -0,0 +1,406 @@
+/*
+ *   File:   modbus.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 20:51
+ *
+ *   Modbus RTU slave on the console UART, for SCADA polling. Register map
+ *   is in modbus.h.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <util/crc16.h>
+
+#include "config.h"
+#include "main.h"
+#include "modbus.h"
+#include "sampler.h"
+#include "timeout.h"
+#include "usart_buffered.h"
+#include "util.h"
+
+#ifdef _MODBUS_
+
+#define MODBUS_MAX_FRAME        72
+#define MODBUS_MAX_REGS         32 // Per read, so the response fits in the buffer
+
+#define MB_READ_HOLDING         0x03
+#define MB_READ_INPUT           0x04
+#define MB_WRITE_SINGLE         0x06
+#define MB_WRITE_MULTIPLE       0x10
+
+#define MB_EX_FUNCTION          0x01
+#define MB_EX_ADDRESS           0x02
+#define MB_EX_VALUE             0x03
+#define MB_EX_FAILURE           0x04
+
+static uint8_t _g_mb_buf[MODBUS_MAX_FRAME];
+static uint8_t _g_mb_len;
+static bool _g_mb_overflow;
+static bool _g_mb_active;
+static int8_t _g_mb_timer = -1;
+
+static uint16_t get_be16(const uint8_t *buf)
+{
+    return (uint16_t)buf[0] << 8 | buf[1];
+}
+
+static void put_be16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = (uint8_t)(value >> 8);
+    buf[1] = (uint8_t)(value & 0xFF);
+}
+
+static uint16_t modbus_crc(const uint8_t *buf, uint8_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
+        crc = _crc16_update(crc, *buf++);
+
+    return crc;
+}
+
+static void modbus_send(uint8_t *buf, uint8_t len)
+{
+    uint16_t crc = modbus_crc(buf, len);
+    uint8_t i;
+
+    // The one little endian field in Modbus
+    buf[len++] = (uint8_t)(crc & 0xFF);
+    buf[len++] = (uint8_t)(crc >> 8);
+
+    for (i = 0; i < len; i++)
+        console1_put(buf[i]);
+}
+
+static uint8_t modbus_exception(uint8_t *buf, uint8_t code)
+{
+    buf[1] |= 0x80;
+    buf[2] = code;
+    return 3;
+}
+
+static uint16_t modbus_status(sys_runstate_t *rs, uint16_t *avg_volts, uint32_t *total_amps)
+{
+    psu_totals_t totals;
+    uint16_t status = 0;
+    uint8_t i;
+
+    for (i = 0; i < rs->psu_num; i++) {
+        if (_g_samples[i].flags & SAMPLE_ERROR)
+            status |= MODBUS_STATUS_READ_ERROR;
+    }
+
+    sampler_totals(rs->psu_num, &totals);
+
+    *avg_volts = totals.avg_volts;
+    *total_amps = totals.amps;
+
+    if (PS_ON_STATE)
+        status |= MODBUS_STATUS_OUTPUT_ON;
+    if (rs->outvoltage_stale)
+        status |= MODBUS_STATUS_STALE;
+
+    return status;
+}
+
+static bool modbus_input_reg(sys_runstate_t *rs, uint16_t reg, uint16_t *value)
+{
+    uint16_t avg_volts;
+    uint32_t total_amps;
+    uint16_t status;
+
+    if (reg >= MODBUS_IR_PSU_BASE) {
+        uint16_t psu = (reg - MODBUS_IR_PSU_BASE) / MODBUS_IR_PSU_REGS;
+        psu_sample_t *sample;
+
+        if (psu >= MAX_PSU)
+            return false;
+
+        sample = &_g_samples[psu];
+
+        // Slots past psu_num read as zero so hosts can always ask for all eight
+        if (psu >= rs->psu_num) {
+            *value = 0;
+            return true;
+        }
+
+        switch ((reg - MODBUS_IR_PSU_BASE) % MODBUS_IR_PSU_REGS) {
+        case 0:
+            *value = sample->volts;
+            break;
+        case 1:
+            *value = sample->amps;
+            break;
+        default:
+            *value = sample->flags | (uint16_t)sample->errors << 8;
+            break;
+        }
+
+        return true;
+    }
+
+    status = modbus_status(rs, &avg_volts, &total_amps);
+
+    switch (reg) {
+    case MODBUS_IR_PSU_NUM:
+        *value = rs->psu_num;
+        break;
+    case MODBUS_IR_TOTAL_AMPS:
+        // One register. Pins at 655.35 A rather than wrapping
+        *value = total_amps > 0xFFFF ? 0xFFFF : total_amps;
+        break;
+    case MODBUS_IR_TOTAL_AMPS_HI:
+        *value = (uint16_t)(total_amps >> 16);
+        break;
+    case MODBUS_IR_TOTAL_AMPS_LO:
+        *value = (uint16_t)(total_amps & 0xFFFF);
+        break;
+    case MODBUS_IR_AVG_VOLTS:
+        *value = avg_volts;
+        break;
+    case MODBUS_IR_STATUS:
+        *value = status;
+        break;
+    default:
+        *value = 0; // Reserved, up to the first PSU
+        break;
+    }
+
+    return true;
+}
+
+static bool modbus_holding_reg(sys_runstate_t *rs, uint16_t reg, uint16_t *value)
+{
+    switch (reg) {
+    case MODBUS_HR_OUTPUT_VOLTAGE:
+        *value = rs->config->output_voltage;
+        return true;
+    case MODBUS_HR_START_MODE:
+        *value = rs->config->start_mode;
+        return true;
+    case MODBUS_HR_OUTPUT_ON:
+        *value = PS_ON_STATE;
+        return true;
+    case MODBUS_HR_SLAVE_ADDR:
+        *value = rs->config->modbus_addr;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Returns an exception code, or 0 if it went OK.
+ */
+static uint8_t modbus_write_holding(sys_runstate_t *rs, uint16_t reg, uint16_t value)
+{
+    switch (reg) {
+    case MODBUS_HR_OUTPUT_VOLTAGE:
+        if (value < OUTPUT_VOLTAGE_MIN || value > OUTPUT_VOLTAGE_MAX)
+            return MB_EX_VALUE;
+        return psu_set_output_voltage(rs, value) ? 0 : MB_EX_FAILURE;
+    case MODBUS_HR_START_MODE:
+        if (value > 1)
+            return MB_EX_VALUE;
+        rs->config->start_mode = value;
+        save_configuration(rs->config);
+        return 0;
+    case MODBUS_HR_OUTPUT_ON:
+        if (value > 1)
+            return MB_EX_VALUE;
+        return psu_change_state(rs, value) ? 0 : MB_EX_FAILURE;
+    case MODBUS_HR_SLAVE_ADDR:
+        if (value > MODBUS_ADDR_MAX)
+            return MB_EX_VALUE;
+        // Replies to this request still come from the old address
+        rs->config->modbus_addr = value;
+        save_configuration(rs->config);
+        return 0;
+    }
+
+    return MB_EX_ADDRESS;
+}
+
+/*
+ * Builds the response over the request. Returns its length without CRC.
+ */
+static uint8_t modbus_handle(sys_runstate_t *rs, uint8_t *buf, uint8_t len)
+{
+    uint8_t func = buf[1];
+    uint16_t start;
+    uint16_t count;
+    uint16_t value;
+    uint8_t ex;
+    uint8_t i;
+
+    if (func != MB_READ_HOLDING && func != MB_READ_INPUT &&
+            func != MB_WRITE_SINGLE && func != MB_WRITE_MULTIPLE)
+        return modbus_exception(buf, MB_EX_FUNCTION);
+
+    if (len < 6)
+        return modbus_exception(buf, MB_EX_VALUE);
+
+    start = get_be16(&buf[2]);
+    count = get_be16(&buf[4]); // Or the value, for a single write
+
+    switch (func) {
+    case MB_READ_HOLDING:
+    case MB_READ_INPUT:
+        if (len != 6 || !count || count > MODBUS_MAX_REGS)
+            return modbus_exception(buf, MB_EX_VALUE);
+
+        for (i = 0; i < count; i++) {
+            bool ok = (func == MB_READ_HOLDING) ?
+                modbus_holding_reg(rs, start + i, &value) : modbus_input_reg(rs, start + i, &value);
+
+            if (!ok)
+                return modbus_exception(buf, MB_EX_ADDRESS);
+
+            put_be16(&buf[3 + i * 2], value);
+        }
+
+        buf[2] = count * 2;
+        return 3 + count * 2;
+    case MB_WRITE_SINGLE:
+        if (len != 6)
+            return modbus_exception(buf, MB_EX_VALUE);
+
+        ex = modbus_write_holding(rs, start, count);
+        if (ex)
+            return modbus_exception(buf, ex);
+
+        return 6; // Echo
+    default: // MB_WRITE_MULTIPLE
+        if (!count || len < 7 || buf[6] != count * 2 || len != 7 + count * 2)
+            return modbus_exception(buf, MB_EX_VALUE);
+        if (start + count > MODBUS_HR_COUNT)
+            return modbus_exception(buf, MB_EX_ADDRESS);
+
+        for (i = 0; i < count; i++) {
+            ex = modbus_write_holding(rs, start + i, get_be16(&buf[7 + i * 2]));
+            if (ex)
+                return modbus_exception(buf, ex);
+        }
+
+        return 6; // Address, function, start, count
+    }
+}
+
+static void modbus_stop(sys_runstate_t *rs)
+{
+    _g_mb_active = false;
+    console_mute(false);
+    usart1_set_flow_control(rs->config->flow_control);
+}
+
+/*
+ * Gap timer. The line has been quiet for 3.5 characters so whatever is in
+ * the buffer is a whole frame.
+ */
+static void modbus_frame(void *param)
+{
+    sys_runstate_t *rs = (sys_runstate_t *)param;
+    uint8_t *buf = _g_mb_buf;
+    uint8_t len = _g_mb_len;
+    uint8_t addr = buf[0];
+
+    if (console1_data_ready()) {
+        // The idle loop was held up, not the line. More of this frame is waiting
+        timeout_start(_g_mb_timer);
+        return;
+    }
+
+    _g_mb_len = 0;
+
+    if (_g_mb_overflow) {
+        _g_mb_overflow = false;
+        return;
+    }
+
+    // Bad frames and other slaves' traffic get no reply
+    if (len < 4 || modbus_crc(buf, len - 2) != (buf[len - 2] | (uint16_t)buf[len - 1] << 8))
+        return;
+    if (addr != 0 && addr != rs->config->modbus_addr)
+        return;
+
+    len = modbus_handle(rs, buf, len - 2);
+
+    if (addr != 0) // Broadcasts are never answered
+        modbus_send(buf, len);
+
+    if (!rs->config->modbus_addr)
+        modbus_stop(rs);
+}
+
+/*
+ * Takes over the console until holding register MODBUS_HR_SLAVE_ADDR is
+ * set to 0. Text output is muted and flow control is off meanwhile.
+ */
+bool modbus_start(sys_runstate_t *rs)
+{
+    uint32_t baud = rs->config->baud;
+    // 3.5 characters of 11 bits. Fixed at 1.75 ms above 19200 baud
+    uint16_t gap = baud > 19200 ? 2 : (38500 + baud - 1) / baud;
+
+    if (_g_mb_timer >= 0)
+        timeout_destroy(_g_mb_timer);
+
+    _g_mb_timer = timeout_create(gap, false, false, &modbus_frame, (void *)rs);
+    if (_g_mb_timer < 0)
+        return false;
+
+    _g_mb_len = 0;
+    _g_mb_overflow = false;
+    _g_mb_active = true;
+
+    usart1_set_flow_control(false);
+    console_mute(true);
+
+    return true;
+}
+
+bool modbus_active(void)
+{
+    return _g_mb_active;
+}
+
+void modbus_process(sys_runstate_t *rs)
+{
+    bool rx = false;
+
+    while (console1_data_ready()) {
+        uint8_t c = console1_get();
+
+        if (_g_mb_len < MODBUS_MAX_FRAME)
+            _g_mb_buf[_g_mb_len++] = c;
+        else
+            _g_mb_overflow = true; // Dropped at the end of the frame
+
+        rx = true;
+    }
+
+    if (rx)
+        timeout_start(_g_mb_timer);
+}
+
+#endif /* _MODBUS_ */
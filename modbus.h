@@ -0,0 +1,55 @@
+/*
+ *   File:   modbus.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 20:51
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MODBUS_H__
+#define __MODBUS_H__
+
+#define MODBUS_ADDR_MAX             247
+
+#ifdef _MODBUS_
+
+/* Input registers (function 04). Values from the sample table */
+#define MODBUS_IR_PSU_NUM           0
+#define MODBUS_IR_TOTAL_AMPS        1  // 0.01 A. Saturates at 0xFFFF; use the pair below
+#define MODBUS_IR_AVG_VOLTS         2  // 0.01 V
+#define MODBUS_IR_STATUS            3  // See below
+#define MODBUS_IR_TOTAL_AMPS_HI     4  // 0.01 A, 32 bits, high word first. Read both
+#define MODBUS_IR_TOTAL_AMPS_LO     5  // in one request so they're from the same readings
+#define MODBUS_IR_PSU_BASE          10 // PSU n at +3n: volts, amps, sample flags | errors << 8
+#define MODBUS_IR_PSU_REGS          3
+
+#define MODBUS_STATUS_OUTPUT_ON     0x0001
+#define MODBUS_STATUS_READ_ERROR    0x0002 // Last read of at least one PSU failed
+#define MODBUS_STATUS_STALE         0x0004 // output_voltage not yet applied to the PSUs
+
+/* Holding registers (functions 03, 06 and 16) */
+#define MODBUS_HR_OUTPUT_VOLTAGE    0  // 0.01 V
+#define MODBUS_HR_START_MODE        1
+#define MODBUS_HR_OUTPUT_ON         2
+#define MODBUS_HR_SLAVE_ADDR        3  // 0 hands the port back to the CLI
+#define MODBUS_HR_COUNT             4
+
+bool modbus_start(sys_runstate_t *rs);
+bool modbus_active(void);
+void modbus_process(sys_runstate_t *rs);
+
+#endif /* _MODBUS_ */
+
+#endif /* __MODBUS_H__ */
@@ -0,0 +1,293 @@
+/*
+ *   File:   monitor.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 20:51
+ *
+ *   Live views of the sample table on the console. They run from a timer
+ *   until a key is pressed (see cmd_process()).
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "config.h"
+#include "main.h"
+#include "monitor.h"
+#include "sampler.h"
+#include "timeout.h"
+#include "usart_buffered.h"
+#include "util.h"
+
+#define MONITOR_STREAM      0
+#define MONITOR_WATCH       1
+
+/* Terminal rows and columns are 1 based */
+#define WATCH_ROW_FIRST     4
+#define WATCH_COL_VOLTS     7
+#define WATCH_COL_AMPS      16
+#define WATCH_COL_SHARE     25
+#define WATCH_COL_ERRORS    32
+#define WATCH_NUM_WIDTH     6  // "123.45", as most PSU readings fit
+#define WATCH_FIELD_MAX     16 // Worst case bytes to move to and draw one field
+
+typedef struct {
+    uint16_t volts;
+    uint32_t amps;      // The total is the sum of all eight
+    uint8_t share;      // Percent of the total current
+    uint16_t errors;    // Wider than the sample's so 0xFFFF can mean "never drawn"
+} watch_row_t;
+
+static int8_t _g_monitor_timer = -1;
+static uint8_t _g_monitor_mode;
+static uint8_t _g_monitor_format;
+static watch_row_t _g_watch_shown[MAX_PSU + 1]; // As on screen. Last one is the total
+static uint8_t _g_watch_psus;
+
+static void monitor_stream_line(void *param)
+{
+    sys_runstate_t *rs = (sys_runstate_t *)param;
+    uint32_t now = get_tick_count() * TIMEOUT_MS_PER_TICK;
+    psu_totals_t totals;
+    uint8_t errors = 0;
+    uint8_t policy;
+    uint8_t i;
+
+    // A line that won't fit is cut short rather than holding up the loop
+    policy = console_set_policy(CONSOLE_TRUNCATE);
+
+    printf("%lu", now);
+
+    for (i = 0; i < rs->psu_num; i++) {
+        psu_sample_t *sample = &_g_samples[i];
+
+        if (sample->flags & SAMPLE_ERROR || !(sample->flags & SAMPLE_VALID))
+            errors |= _BV(i);
+
+        putchar(_g_monitor_format == STREAM_CSV ? ',' : ' ');
+        print_2dp(sample->volts, 0);
+        putchar(_g_monitor_format == STREAM_CSV ? ',' : '/');
+        print_2dp(sample->amps, 0);
+
+        if (_g_monitor_format == STREAM_CSV)
+            printf(",%u", sample->flags);
+    }
+
+    // Same total as everywhere else: good readings only
+    sampler_totals(rs->psu_num, &totals);
+
+    if (_g_monitor_format == STREAM_CSV) {
+        putchar(',');
+        print_2dp(totals.amps, 0);
+        printf("\r\n");
+    } else {
+        printf(" T:");
+        print_2dp(totals.amps, 0);
+        printf(" E:%02X\r\n", errors);
+    }
+
+    console_set_policy(policy);
+}
+
+/*
+ * One line per interval: milliseconds since boot, then volts and amps of
+ * each PSU and the total current. Compact lines end with a bitmask of the
+ * PSUs without a good reading; CSV gives each PSU's sample flags instead.
+ */
+bool monitor_stream_start(sys_runstate_t *rs, uint16_t interval, uint8_t format)
+{
+    uint8_t i;
+
+    monitor_stop();
+
+    _g_monitor_timer = timeout_create(interval, true, true, &monitor_stream_line, (void *)rs);
+
+    if (_g_monitor_timer < 0)
+        return false;
+
+    _g_monitor_mode = MONITOR_STREAM;
+    _g_monitor_format = format;
+
+    printf("Streaming every %u ms. Press any key to stop\r\n", interval);
+
+    if (format == STREAM_CSV) {
+        printf("ms");
+        for (i = 0; i < rs->psu_num; i++) {
+            uint8_t addr = rs->psu_addrs[i];
+            printf(",0x%02X_V,0x%02X_A,0x%02X_flags", addr, addr, addr);
+        }
+        printf(",total_A\r\n");
+    }
+
+    return true;
+}
+
+static uint8_t watch_row(uint8_t idx)
+{
+    // Blank line between the PSUs and the total
+    return WATCH_ROW_FIRST + idx + (idx == _g_watch_psus ? 1 : 0);
+}
+
+static void watch_goto(uint8_t row, uint8_t col)
+{
+    printf("\x1b[%u;%uH", row, col);
+}
+
+/*
+ * Draws only what differs from what's on screen, and only while the TX
+ * ring has room for a whole field. Whatever doesn't fit keeps its old
+ * shadow value, so it's picked up by the next frame.
+ */
+static void watch_draw(void)
+{
+    psu_totals_t totals;
+    uint16_t total_errors = 0;
+    uint8_t i;
+
+    sampler_totals(_g_watch_psus, &totals);
+
+    for (i = 0; i < _g_watch_psus; i++)
+        total_errors += _g_samples[i].errors;
+
+    for (i = 0; i <= _g_watch_psus; i++) {
+        watch_row_t *shown = &_g_watch_shown[i];
+        uint8_t row = watch_row(i);
+        watch_row_t now;
+
+        if (i < _g_watch_psus) {
+            psu_sample_t *sample = &_g_samples[i];
+
+            bool good = (sample->flags & SAMPLE_VALID) && !(sample->flags & SAMPLE_ERROR);
+
+            now.volts = sample->volts;
+            now.amps = sample->amps;
+            // Share of the total, which only counts good readings
+            now.share = good && totals.amps ? (uint32_t)sample->amps * 100 / totals.amps : 0;
+            now.errors = sample->errors;
+        } else {
+            now.volts = totals.avg_volts;
+            now.amps = totals.amps;
+            now.share = totals.amps ? 100 : 0;
+            now.errors = total_errors;
+        }
+
+        if (now.volts != shown->volts) {
+            if (console1_tx_free() < WATCH_FIELD_MAX)
+                return;
+            watch_goto(row, WATCH_COL_VOLTS);
+            print_2dp(now.volts, WATCH_NUM_WIDTH);
+            shown->volts = now.volts;
+        }
+
+        if (now.amps != shown->amps) {
+            if (console1_tx_free() < WATCH_FIELD_MAX)
+                return;
+            watch_goto(row, WATCH_COL_AMPS);
+            print_2dp(now.amps, WATCH_NUM_WIDTH);
+            shown->amps = now.amps;
+        }
+
+        if (now.share != shown->share) {
+            if (console1_tx_free() < WATCH_FIELD_MAX)
+                return;
+            watch_goto(row, WATCH_COL_SHARE);
+            printf("%3u%%", now.share);
+            shown->share = now.share;
+        }
+
+        if (now.errors != shown->errors) {
+            if (console1_tx_free() < WATCH_FIELD_MAX)
+                return;
+            watch_goto(row, WATCH_COL_ERRORS);
+            printf("%5u", now.errors);
+            shown->errors = now.errors;
+        }
+    }
+}
+
+static void monitor_watch_frame(void *param)
+{
+    // The console is muted in between, so only the table gets out
+    console_mute(false);
+    watch_draw();
+    console_mute(true);
+}
+
+/*
+ * Full screen table of every PSU, redrawn in place. After the first frame
+ * only the fields that changed are sent, typically a few dozen bytes.
+ */
+bool monitor_watch_start(sys_runstate_t *rs)
+{
+    uint8_t i;
+
+    monitor_stop();
+
+    _g_monitor_timer = timeout_create(WATCH_INTERVAL_MS, true, true, &monitor_watch_frame, (void *)rs);
+
+    if (_g_monitor_timer < 0)
+        return false;
+
+    _g_monitor_mode = MONITOR_WATCH;
+    _g_watch_psus = rs->psu_num;
+
+    memset(_g_watch_shown, 0xFF, sizeof(_g_watch_shown)); // Nothing matches, so all get drawn
+
+    // Hide the cursor, clear, home
+    printf("\x1b[?25l\x1b[2J\x1b[H");
+    printf("Live readings. Press any key to stop\r\n\r\n");
+    printf("PSU   Volts    Amps     Share  Errors");
+
+    for (i = 0; i < _g_watch_psus; i++) {
+        watch_goto(watch_row(i), 1);
+        printf("0x%02X", rs->psu_addrs[i]);
+    }
+
+    watch_goto(watch_row(_g_watch_psus), 1);
+    printf("Total");
+
+    // Anything else printed meanwhile (errors, output on or off) would land
+    // wherever the cursor is and never be drawn over, so it's dropped
+    console_mute(true);
+
+    return true;
+}
+
+bool monitor_active(void)
+{
+    return _g_monitor_timer >= 0;
+}
+
+void monitor_stop(void)
+{
+    if (_g_monitor_timer < 0)
+        return;
+
+    timeout_destroy(_g_monitor_timer);
+    _g_monitor_timer = -1;
+
+    // Park the cursor under the table and bring it back
+    if (_g_monitor_mode == MONITOR_WATCH) {
+        console_mute(false);
+        printf("\x1b[%u;1H\x1b[?25h", watch_row(_g_watch_psus) + 1);
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ *   File:   monitor.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 20:51
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MONITOR_H__
+#define __MONITOR_H__
+
+#define STREAM_COMPACT          0
+#define STREAM_CSV              1
+
+#define STREAM_INTERVAL_MIN     100
+#define STREAM_INTERVAL_MAX     30000
+
+#define WATCH_INTERVAL_MS       200
+
+bool monitor_stream_start(sys_runstate_t *rs, uint16_t interval, uint8_t format);
+bool monitor_watch_start(sys_runstate_t *rs);
+bool monitor_active(void);
+void monitor_stop(void);
+
+#endif /* __MONITOR_H__ */
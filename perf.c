@@ -0,0 +1,146 @@
+/*
+ *   File:   perf.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 21:09
+ *
+ *   Time spent in the idle loop and the PSU calls, per site, off the
+ *   Timer1 stamps. Sites are listed in perf.h.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "perf.h"
+#include "timeout.h"
+#include "util.h"
+
+#ifdef _PERF_
+
+#define PERF_NAME_MAX       11
+
+typedef struct {
+    uint32_t count;     // Halved with total when total fills
+    uint32_t total;
+    uint16_t min;       // All in us. These two pin at 65535
+    uint16_t max;
+    uint16_t buckets[PERF_BUCKETS];
+} perf_site_t;
+
+static const char _g_perf_names[PERF_SITES][PERF_NAME_MAX] PROGMEM = {
+    "loop",
+    "timeout",
+    "task",
+    "i2c",
+    "cmd",
+    "lcd",
+    "update_lcd",
+    "dev_info",
+    "serial",
+    "cache_fill",
+    "telemetry",
+    "poll",
+    "read_sv",
+    "write_sv",
+};
+
+static perf_site_t _g_perf[PERF_SITES];
+
+/*
+ * Called from the idle loop only, never from an ISR.
+ */
+void perf_record(uint8_t site, uint32_t start)
+{
+    perf_site_t *p = &_g_perf[site];
+    uint32_t us = get_stamp_us(start, get_timer_stamp());
+    uint16_t clipped = us > 0xFFFF ? 0xFFFF : us;
+    uint32_t scaled = us >> 4;
+    uint8_t bucket = 0;
+
+    while (scaled && bucket < PERF_BUCKETS - 1) {
+        scaled >>= 2;
+        bucket++;
+    }
+
+    if (p->buckets[bucket] != 0xFFFF)
+        p->buckets[bucket]++;
+
+    if (p->total > 0xFFFFFFFF - us) {
+        // Keeps the mean, but from here on older times count for less
+        p->total >>= 1;
+        p->count >>= 1;
+    }
+
+    p->total += us;
+    p->count++;
+
+    if (clipped < p->min)
+        p->min = clipped;
+    if (clipped > p->max)
+        p->max = clipped;
+}
+
+void perf_scope_end(perf_scope_t *scope)
+{
+    perf_record(scope->site, scope->start);
+}
+
+void perf_reset(void)
+{
+    uint8_t i;
+
+    memset(_g_perf, 0, sizeof(_g_perf));
+
+    for (i = 0; i < PERF_SITES; i++)
+        _g_perf[i].min = 0xFFFF;
+}
+
+void perf_report(void)
+{
+    char name[PERF_NAME_MAX];
+    uint8_t i;
+    uint8_t j;
+
+    printf("Times in us. Buckets are under 16, 64, 256 us, 1, 4, 16 ms and over\r\n");
+    printf("Nested sites are part of the loop figures, with the profiling cost\r\n\r\n");
+    printf("Site          Count   Min   Max  Mean   <16   <64  <256   <1m   <4m  <16m  more\r\n");
+
+    for (i = 0; i < PERF_SITES; i++) {
+        perf_site_t *p = &_g_perf[i];
+
+        strcpy_P(name, _g_perf_names[i]);
+        printf("%-10s", name);
+
+        if (!p->count) {
+            printf("        0     -     -     -\r\n");
+            continue;
+        }
+
+        printf("%9lu%6u%6u%6lu", p->count, p->min, p->max, p->total / p->count);
+
+        for (j = 0; j < PERF_BUCKETS; j++)
+            printf("%6u", p->buckets[j]);
+
+        printf("\r\n");
+    }
+}
+
+#endif /* _PERF_ */
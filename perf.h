@@ -0,0 +1,80 @@
+/*
+ *   File:   perf.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 21:09
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PERF_H__
+#define __PERF_H__
+
+// Idle loop, as a whole and each call
+#define PERF_LOOP           0
+#define PERF_TIMEOUT        1
+#define PERF_TASK           2
+#define PERF_I2C            3
+#define PERF_CMD            4
+#define PERF_LCD            5
+#define PERF_UPDATE_LCD     6
+// PSU calls. All but poll wait on the bus
+#define PERF_PSU_INFO       7
+#define PERF_PSU_SERIAL     8
+#define PERF_PSU_CACHE      9
+#define PERF_PSU_TELEMETRY  10
+#define PERF_PSU_POLL       11
+#define PERF_PSU_READ_SV    12
+#define PERF_PSU_WRITE_SV   13
+#define PERF_SITES          14
+
+/*
+ * Bucket n counts times under 16 << (2 * n) us. The last takes the rest.
+ * RAM is 26 bytes a site.
+ */
+#define PERF_BUCKETS        7
+
+#ifdef _PERF_
+
+typedef struct {
+    uint32_t start;
+    uint8_t site;
+} perf_scope_t;
+
+/*
+ * PERF_BEGIN and PERF_END go in the same block. PERF_SCOPE times from
+ * where it is to whichever return leaves the function.
+ */
+#define PERF_BEGIN(site)    uint32_t _perf_start_##site = get_timer_stamp()
+#define PERF_END(site)      perf_record((site), _perf_start_##site)
+#define PERF_RUN(site, call) \
+    do { PERF_BEGIN(site); call; PERF_END(site); } while (0)
+#define PERF_SCOPE(site) \
+    perf_scope_t _perf_scope __attribute__((cleanup(perf_scope_end))) = { get_timer_stamp(), (site) }
+
+void perf_record(uint8_t site, uint32_t start);
+void perf_scope_end(perf_scope_t *scope);
+void perf_reset(void);
+void perf_report(void);
+
+#else
+
+#define PERF_BEGIN(site)
+#define PERF_END(site)
+#define PERF_RUN(site, call) call
+#define PERF_SCOPE(site)
+
+#endif /* _PERF_ */
+
+#endif /* __PERF_H__ */
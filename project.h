@@ -28,19 +28,42 @@
 
 #define _USART1_
 #define _CONSOLE1_
+#define _MODBUS_            // Modbus RTU slave. Comment out to save flash and RAM
+#define _STATS_             // Rolling statistics per PSU. RAM cost is set in stats.h
+//#define _BENCHMARK_       // 'bench' command, for timing the number formatting
+//#define _PERF_            // 'perf' command, for timing the idle loop. About 370 bytes of RAM
+//#define _LATENCY_         // 'latency' command, for ISR and interrupts off times
 
 #define F_CPU               14745600
 
 #define CONFIG_MAGIC        0x4650
+#define INVENTORY_MAGIC     0x4649
+#define ENERGY_MAGIC        0x4645
 
 #define OUTPUT_VOLTAGE_DEFAULT  1200
 #define OUTPUT_VOLTAGE_MAX      1245 // PSU Will not accept anything above this
 #define OUTPUT_VOLTAGE_MIN      100
 
+#define HITLESS_MAX_STEP        25  // Largest live set voltage change per step
+#define HITLESS_TOLERANCE       20  // Measured voltage must land within this of the set point
+#define HITLESS_SETTLE_MS       20  // Wait after each step before measuring the output
+#define HITLESS_RETRIES         5   // Measurements before a PSU counts as refusing the step
+
+#define SAMPLE_INTERVAL_DEFAULT 250 // ms between current polls. Slower groups are multiples
+#define SAMPLE_INTERVAL_MIN     100
+#define SAMPLE_INTERVAL_MAX     10000
+
 #define CLRWDT() asm("wdr")
 
+#ifdef _LATENCY_
+void latency_irq_disable(void);
+void latency_irq_enable(void);
+#define g_irq_disable latency_irq_disable // Times each window. See latency.c
+#define g_irq_enable latency_irq_enable
+#else
 #define g_irq_disable cli
 #define g_irq_enable sei
+#endif /* _LATENCY_ */
 
 #define MAX_PSU            8
 
@@ -73,13 +96,18 @@
 #define USART1_RX          PD0
 #define USART1_XCK         PD4
 
-#define UART1_BAUD         9600
+#define UART1_BAUD         9600 // Default, and the fallback for a bad stored rate
+#define UART1_BRG(baud)    (((F_CPU / (baud)) / 16) - 1)
+
+#define BAUD_CONFIRM_MS    15000 // A new rate is dropped unless a line arrives at it by then
 
-#define TIMEOUT_TICK_PER_SECOND  (10)
+#define TIMEOUT_TICK_PER_SECOND  (1000)
 #define TIMEOUT_MS_PER_TICK      (1000 / TIMEOUT_TICK_PER_SECOND)
 
 #define console1_busy         usart1_busy
 #define console1_put          usart1_put
+#define console1_try_put      usart1_try_put
+#define console1_tx_free      usart1_tx_free
 #define console1_data_ready   usart1_data_ready
 #define console1_get          usart1_get
 #define console1_clear_oerr   usart1_clear_oerr
@@ -0,0 +1,288 @@
+/*
+ *   File:   sampler.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 20:40
+ *
+ *   Background telemetry sampler. Polls every PSU in the background to
+ *   feed the LCD, the CLI and anything else that wants the numbers.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "config.h"
+#include "main.h"
+#include "energy.h"
+#include "sampler.h"
+#include "stats.h"
+#include "fnppsu.h"
+#include "timeout.h"
+#include "util.h"
+
+/*
+ * Reads are handed out in slots rather than whole rounds at once, so the
+ * bus never sees every group of every PSU land in the same tick.
+ */
+#define SAMPLER_SLOT_MS         100
+#define SAMPLER_SLOT_BUDGET     6   // Most reads issued per slot
+
+#define SAMPLE_HAVE_TELEMETRY   (_BV(FNPPSU_POLL_CURRENT) | _BV(FNPPSU_POLL_VOLTAGE))
+
+typedef struct {
+    bool active;        // Part way round the PSUs
+    bool served;        // Had a read issued this slot
+    uint8_t wait;       // Slots in a row it was due but got nothing
+    uint8_t next_psu;
+    uint32_t next_due;  // Tick count the next round may start
+} sampler_group_t;
+
+psu_sample_t _g_samples[MAX_PSU];
+
+static sys_runstate_t *_g_sampler_rs;
+static sampler_group_t _g_sampler_groups[FNPPSU_POLL_GROUPS];
+static fnppsu_meas_t _g_sampler_meas;
+static uint8_t _g_sampler_psu;
+static uint8_t _g_sampler_budget;
+static bool _g_sampler_busy;
+
+static void sampler_slot(void *param);
+static void sampler_meas_done(fnppsu_meas_t *meas);
+
+void sampler_init(sys_runstate_t *rs)
+{
+    _g_sampler_rs = rs;
+    _g_sampler_busy = false;
+    _g_sampler_meas.callback = &sampler_meas_done;
+
+    sampler_reset();
+
+    timeout_create(SAMPLER_SLOT_MS, true, true, &sampler_slot, (void *)rs);
+}
+
+void sampler_reset(void)
+{
+    uint32_t now = get_tick_count();
+    uint8_t i;
+
+    memset(_g_samples, 0, sizeof(_g_samples));
+    memset(_g_sampler_groups, 0, sizeof(_g_sampler_groups));
+
+    for (i = 0; i < FNPPSU_POLL_GROUPS; i++)
+        _g_sampler_groups[i].next_due = now; // All due now
+}
+
+uint32_t sampler_age_ms(psu_sample_t *sample)
+{
+    return (get_tick_count() - sample->timestamp) * TIMEOUT_MS_PER_TICK;
+}
+
+/*
+ * Hundredths of a watt. Both readings are in hundredths so the product is
+ * in ten thousandths; it just fits 32 bits at the 16 bit maximums.
+ */
+uint32_t sampler_watts(psu_sample_t *sample)
+{
+    return (uint32_t)sample->volts * sample->amps / 100;
+}
+
+void sampler_totals(uint8_t psu_num, psu_totals_t *totals)
+{
+    uint32_t volts = 0;
+    uint8_t i;
+
+    memset(totals, 0, sizeof(psu_totals_t));
+
+    for (i = 0; i < psu_num; i++) {
+        psu_sample_t *sample = &_g_samples[i];
+
+        if (!(sample->flags & SAMPLE_VALID) || (sample->flags & SAMPLE_ERROR))
+            continue;
+
+        volts += sample->volts;
+        totals->amps += sample->amps;
+        totals->watts += sampler_watts(sample);
+        totals->good++;
+    }
+
+    totals->avg_volts = totals->good ? volts / totals->good : 0;
+}
+
+static bool sampler_group_due(sampler_group_t *group, uint32_t now)
+{
+    return group->active || tick_reached(now, group->next_due);
+}
+
+/*
+ * Issues the next read: the next PSU of the most important group that is
+ * either due or part way round. Returns false when there's nothing more
+ * to do this slot.
+ *
+ * A group's priority goes up by one for every slot it has waited, so when
+ * the budget can't cover everything (a short sample interval and a lot of
+ * PSUs) the current reads can't shut the others out for good.
+ */
+static bool sampler_next(sys_runstate_t *rs)
+{
+    fnppsu_poll_group_t info;
+    sampler_group_t *group;
+    uint32_t now = get_tick_count();
+    int16_t best_rank = 0x7FFF;
+    uint8_t best_rate = 0;
+    int8_t best = -1;
+    uint8_t i;
+
+    if (!_g_sampler_budget || !PS_ON_STATE || !rs->psu_num)
+        return false;
+
+    for (i = 0; i < FNPPSU_POLL_GROUPS; i++) {
+        int16_t rank;
+
+        group = &_g_sampler_groups[i];
+
+        if (!sampler_group_due(group, now))
+            continue;
+
+        fnppsu_poll_group(i, &info);
+
+        rank = (int16_t)info.priority - group->wait;
+
+        if (rank < best_rank) {
+            best_rank = rank;
+            best_rate = info.rate;
+            best = i;
+        }
+    }
+
+    if (best < 0)
+        return false;
+
+    group = &_g_sampler_groups[best];
+
+    if (!group->active) {
+        // Rounds are timed from their start, however long they take
+        group->active = true;
+        group->next_psu = 0;
+        group->next_due = now + (uint32_t)rs->config->sample_interval * best_rate / TIMEOUT_MS_PER_TICK;
+    }
+
+    _g_sampler_psu = group->next_psu;
+
+    // Switched off or re-probed mid-round. Start over.
+    if (_g_sampler_psu >= rs->psu_num) {
+        group->active = false;
+        return sampler_next(rs);
+    }
+
+    if (++group->next_psu >= rs->psu_num)
+        group->active = false;
+
+    group->served = true;
+    group->wait = 0;
+
+    _g_sampler_budget--;
+    return fnppsu_poll_async(&_g_sampler_meas, rs->psu_addrs[_g_sampler_psu], best);
+}
+
+static void sampler_slot(void *param)
+{
+    sys_runstate_t *rs = (sys_runstate_t *)param;
+    psu_totals_t totals;
+    uint32_t now;
+    uint8_t i;
+
+    // Every slot, on or off, so the energy count keeps up with real time
+    if (PS_ON_STATE)
+        sampler_totals(rs->psu_num, &totals);
+    else
+        totals.watts = 0;
+
+    energy_integrate(totals.watts);
+
+    if (_g_sampler_busy || !PS_ON_STATE || !rs->psu_num)
+        return; // Previous read still on the bus, or nothing to do
+
+    now = get_tick_count();
+
+    for (i = 0; i < FNPPSU_POLL_GROUPS; i++) {
+        sampler_group_t *group = &_g_sampler_groups[i];
+
+        if (!group->served && sampler_group_due(group, now) && group->wait < 0xFF)
+            group->wait++;
+
+        group->served = false;
+    }
+
+    // Readings come back through sampler_meas_done() one at a time
+    _g_sampler_budget = SAMPLER_SLOT_BUDGET;
+    _g_sampler_busy = sampler_next(rs);
+}
+
+static void sampler_meas_done(fnppsu_meas_t *meas)
+{
+    psu_sample_t *sample = &_g_samples[_g_sampler_psu];
+
+    sample->addr = meas->xfer.addr;
+
+    if (meas->ok) {
+        switch (meas->group) {
+        case FNPPSU_POLL_CURRENT:
+            sample->amps = meas->value;
+            sample->timestamp = get_tick_count();
+#ifdef _STATS_
+            stats_read(_g_sampler_psu, STATS_AMPS, sample->amps);
+#endif /* _STATS_ */
+            break;
+        case FNPPSU_POLL_VOLTAGE:
+            sample->volts = meas->value;
+#ifdef _STATS_
+            stats_read(_g_sampler_psu, STATS_VOLTS, sample->volts);
+#endif /* _STATS_ */
+            break;
+        case FNPPSU_POLL_SET_VOLTAGE:
+            sample->set_volts = meas->value;
+            break;
+        case FNPPSU_POLL_HOURS:
+            sample->hours = meas->value;
+            break;
+        }
+
+        sample->have |= _BV(meas->group);
+        sample->flags &= ~SAMPLE_ERROR;
+
+        if ((sample->have & SAMPLE_HAVE_TELEMETRY) == SAMPLE_HAVE_TELEMETRY)
+            sample->flags |= SAMPLE_VALID;
+    } else {
+        if (!(sample->flags & SAMPLE_ERROR)) {
+            uint8_t policy = console_set_policy(CONSOLE_TRUNCATE);
+            printf("Error reading measurements from PSU @ 0x%02X\r\n", sample->addr);
+            console_set_policy(policy);
+        }
+
+        sample->flags |= SAMPLE_ERROR;
+
+        if (sample->errors < 0xFF)
+            sample->errors++;
+    }
+
+    _g_sampler_busy = sampler_next(_g_sampler_rs);
+}
@@ -0,0 +1,65 @@
+/*
+ *   File:   sampler.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 20:40
+ *
+ *   Background telemetry sampler. One periodic poll of every PSU feeds
+ *   the LCD, the CLI and anything else that wants the numbers.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#define SAMPLE_VALID          0x01 // Voltage and current both read since reset
+#define SAMPLE_ERROR          0x02 // Last read failed. Values are from the last good one
+
+/*
+ * Each field is refreshed at the rate of its poll group (see fnppsu.c), so
+ * volts can be a few current readings older than amps.
+ */
+typedef struct {
+    uint8_t addr;
+    uint8_t flags;
+    uint8_t have;       // Bit n set once poll group n has been read
+    uint8_t errors;     // Failed reads since reset. Saturates at 255
+    uint16_t volts;
+    uint16_t amps;
+    uint16_t set_volts;
+    uint32_t hours;
+    uint32_t timestamp; // Tick count of the last good current read
+} psu_sample_t;
+
+/*
+ * Over the PSUs with a valid, error free reading. 32 bit, as the sum of
+ * eight supplies at full load doesn't fit in 16.
+ */
+typedef struct {
+    uint8_t good;
+    uint16_t avg_volts;
+    uint32_t amps;
+    uint32_t watts;     // Hundredths
+} psu_totals_t;
+
+void sampler_init(sys_runstate_t *rs);
+void sampler_reset(void);
+uint32_t sampler_age_ms(psu_sample_t *sample);
+uint32_t sampler_watts(psu_sample_t *sample);
+void sampler_totals(uint8_t psu_num, psu_totals_t *totals);
+
+extern psu_sample_t _g_samples[MAX_PSU];
+
+#endif /* __SAMPLER_H__ */
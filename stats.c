@@ -0,0 +1,304 @@
+/*
+ *   File:   stats.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 21:02
+ *
+ *   Rolling current and voltage statistics per PSU, fed by the sampler.
+ *   Every update is O(1): running sums for the mean and deviation, and
+ *   monotonic deques for the window min and max.
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stats.h"
+#include "timeout.h"
+#include "util.h"
+
+#ifdef _STATS_
+
+/*
+ * Indexes into the points ring, oldest first. Values run up the min deque
+ * and down the max one, so the front is always the window's min or max.
+ */
+typedef struct {
+    uint8_t idx[STATS_WINDOW];
+    uint8_t head;
+    uint8_t len;
+} stats_deque_t;
+
+typedef struct {
+    uint16_t points[STATS_WINDOW];  // Ring. Shares its head with the PSU's other series
+    stats_deque_t minq;
+    stats_deque_t maxq;
+    uint32_t sum;
+    uint32_t sumsq;     // Wraps, but exactly, while the window's true total fits 32 bits
+    uint32_t acc;       // Reads so far this period
+    uint16_t acc_num;
+    uint16_t boot_min;
+    uint16_t boot_max;
+    uint32_t boot_sum;
+    uint16_t boot_num;  // Halved with boot_sum when either fills
+    uint16_t peak;
+} stats_series_t;
+
+typedef struct {
+    stats_series_t series[STATS_SERIES];
+    uint8_t head;       // Where the next point goes
+    uint8_t len;
+} stats_psu_t;
+
+static stats_psu_t _g_stats[STATS_PSUS];
+
+static uint8_t stats_wrap(uint8_t i)
+{
+    return i >= STATS_WINDOW ? i - STATS_WINDOW : i;
+}
+
+static uint8_t deque_back(stats_deque_t *q)
+{
+    return q->idx[stats_wrap(q->head + q->len - 1)];
+}
+
+/*
+ * Drops the front if it's the point at idx, which is about to be
+ * overwritten. Anything else older was already pushed out the back.
+ */
+static void deque_expire(stats_deque_t *q, uint8_t idx)
+{
+    if (q->len && q->idx[q->head] == idx) {
+        q->head = stats_wrap(q->head + 1);
+        q->len--;
+    }
+}
+
+/*
+ * Points at the back that can never be the min (or max) again, as the
+ * new one is lower (or higher) and stays in the window longer, are
+ * popped first. Amortised O(1).
+ */
+static void deque_push(stats_deque_t *q, const uint16_t *points, uint8_t idx, bool max)
+{
+    uint16_t value = points[idx];
+
+    while (q->len) {
+        uint16_t back = points[deque_back(q)];
+
+        if (max ? back > value : back < value)
+            break;
+
+        q->len--;
+    }
+
+    q->idx[stats_wrap(q->head + q->len)] = idx;
+    q->len++;
+}
+
+static void stats_push(stats_series_t *s, uint8_t idx, bool full, uint16_t value)
+{
+    if (full) {
+        uint16_t old = s->points[idx];
+
+        s->sum -= old;
+        s->sumsq -= (uint32_t)old * old;
+
+        deque_expire(&s->minq, idx);
+        deque_expire(&s->maxq, idx);
+    }
+
+    s->points[idx] = value;
+    s->sum += value;
+    s->sumsq += (uint32_t)value * value;
+
+    deque_push(&s->minq, s->points, idx, false);
+    deque_push(&s->maxq, s->points, idx, true);
+
+    if (s->boot_num == 0xFFFF || s->boot_sum > 0xFFFFFFFF - value) {
+        // Keeps the mean, but from here on older points count for less
+        s->boot_sum >>= 1;
+        s->boot_num >>= 1;
+    }
+
+    s->boot_sum += value;
+    s->boot_num++;
+
+    if (value < s->boot_min)
+        s->boot_min = value;
+    if (value > s->boot_max)
+        s->boot_max = value;
+}
+
+/*
+ * Closes the period: each series gets the mean of its reads as a new
+ * point. Until every series of a PSU has been read (e.g. output off) the
+ * PSU just keeps accumulating, so its series stay in step on the ring.
+ */
+static void stats_period(void *param)
+{
+    uint8_t i;
+    uint8_t j;
+
+    for (i = 0; i < STATS_PSUS; i++) {
+        stats_psu_t *psu = &_g_stats[i];
+
+        for (j = 0; j < STATS_SERIES; j++) {
+            if (!psu->series[j].acc_num)
+                break;
+        }
+
+        if (j < STATS_SERIES)
+            continue;
+
+        for (j = 0; j < STATS_SERIES; j++) {
+            stats_series_t *s = &psu->series[j];
+
+            stats_push(s, psu->head, psu->len == STATS_WINDOW, s->acc / s->acc_num);
+            s->acc = 0;
+            s->acc_num = 0;
+        }
+
+        psu->head = stats_wrap(psu->head + 1);
+        if (psu->len < STATS_WINDOW)
+            psu->len++;
+    }
+}
+
+void stats_init(void)
+{
+    stats_reset(true);
+    timeout_create(STATS_PERIOD_MS, true, true, &stats_period, NULL);
+}
+
+/*
+ * Takes one reading, from the sampler. PSUs past STATS_PSUS aren't kept.
+ */
+void stats_read(uint8_t psu, uint8_t series, uint16_t value)
+{
+    stats_series_t *s;
+
+    if (psu >= STATS_PSUS)
+        return;
+
+    s = &_g_stats[psu].series[series];
+
+    s->acc += value;
+    s->acc_num++;
+
+    if (value > s->peak)
+        s->peak = value;
+}
+
+/*
+ * Clears the windows and peaks. since_boot clears the rest too, for when
+ * the PSUs change places (rescan).
+ */
+void stats_reset(bool since_boot)
+{
+    uint8_t i;
+    uint8_t j;
+
+    for (i = 0; i < STATS_PSUS; i++) {
+        stats_psu_t *psu = &_g_stats[i];
+
+        psu->head = 0;
+        psu->len = 0;
+
+        for (j = 0; j < STATS_SERIES; j++) {
+            stats_series_t *s = &psu->series[j];
+
+            s->minq.len = 0;
+            s->maxq.len = 0;
+            s->sum = 0;
+            s->sumsq = 0;
+            s->acc = 0;
+            s->acc_num = 0;
+            s->peak = 0;
+
+            if (since_boot) {
+                s->boot_min = 0xFFFF;
+                s->boot_max = 0;
+                s->boot_sum = 0;
+                s->boot_num = 0;
+            }
+        }
+    }
+}
+
+static uint16_t isqrt32(uint32_t x)
+{
+    uint32_t bit = 1UL << 30;
+    uint32_t root = 0;
+
+    while (bit > x)
+        bit >>= 2;
+
+    while (bit) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+/*
+ * False if the PSU isn't tracked or has no points yet. The window figures
+ * are only valid if summary->points isn't zero.
+ */
+bool stats_get(uint8_t psu, uint8_t series, stats_summary_t *summary)
+{
+    stats_psu_t *p;
+    stats_series_t *s;
+    uint8_t n;
+
+    if (psu >= STATS_PSUS)
+        return false;
+
+    p = &_g_stats[psu];
+    s = &p->series[series];
+    n = p->len;
+
+    if (!s->boot_num)
+        return false;
+
+    summary->boot_min = s->boot_min;
+    summary->boot_max = s->boot_max;
+    summary->boot_mean = s->boot_sum / s->boot_num;
+    summary->peak = s->peak;
+    summary->points = n;
+
+    if (!n)
+        return true; // Window just reset
+
+    summary->min = s->points[s->minq.idx[s->minq.head]];
+    summary->max = s->points[s->maxq.idx[s->maxq.head]];
+    summary->mean = s->sum / n;
+    // n^2 var = n sumsq - sum^2, done in 64 bits as sum^2 needn't fit 32
+    summary->stddev = isqrt32(((uint64_t)n * s->sumsq - (uint64_t)s->sum * s->sum) / ((uint16_t)n * n));
+
+    return true;
+}
+
+#endif /* _STATS_ */
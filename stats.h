@@ -0,0 +1,59 @@
+/*
+ *   File:   stats.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 21:02
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+/*
+ * RAM is STATS_PSUS * (8 * STATS_WINDOW + 62) bytes: 94 per PSU and 376
+ * in all at the defaults. Tracking all eight PSUs at these settings would
+ * leave too little for the stack, so trade window length against PSUs.
+ */
+#define STATS_WINDOW        4       // Points in the rolling window, 2 to 127
+#define STATS_PERIOD_MS     15000   // Each point is the mean of the reads over this long
+#define STATS_PSUS          4       // Tracked, in the order found. Up to MAX_PSU
+
+#define STATS_AMPS          0
+#define STATS_VOLTS         1
+#define STATS_SERIES        2
+
+/*
+ * Window figures are over the last points of period means. The since boot
+ * min, max and mean are of period means too, so they're sustained values.
+ * Peak is the highest single read since boot or 'stats reset'.
+ */
+typedef struct {
+    uint8_t points;     // In the window so far. The window figures need at least one
+    uint16_t min;
+    uint16_t max;
+    uint16_t mean;
+    uint16_t stddev;
+    uint16_t boot_min;
+    uint16_t boot_max;
+    uint16_t boot_mean;
+    uint16_t peak;
+} stats_summary_t;
+
+void stats_init(void);
+void stats_read(uint8_t psu, uint8_t series, uint16_t value);
+void stats_reset(bool since_boot);
+bool stats_get(uint8_t psu, uint8_t series, stats_summary_t *summary);
+
+#endif /* __STATS_H__ */
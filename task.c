@@ -0,0 +1,115 @@
+/*
+ *   File:   task.c
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 21:04
+ *
+ *   Cooperative tasks for the slow control paths (power up, discovery,
+ *   output cycling), so they wait on the tick instead of in _delay_ms().
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "task.h"
+#include "timeout.h"
+
+static task_t *_g_tasks[MAX_TASKS];
+
+void task_init(task_t *task, uint8_t (*fn)(task_t *task), void *data)
+{
+    task->line = 0;
+    task->fn = fn;
+    task->data = data;
+}
+
+/*
+ * Returns false if this task is already running, or there's no room.
+ */
+bool task_start(task_t *task, uint8_t (*fn)(task_t *task), void *data)
+{
+    uint8_t i;
+
+    if (task_running(task))
+        return false;
+
+    for (i = 0; i < MAX_TASKS; i++) {
+        if (!_g_tasks[i]) {
+            task_init(task, fn, data);
+            _g_tasks[i] = task;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Drops a task wherever it is waiting. It starts from the top next time.
+ */
+void task_stop(task_t *task)
+{
+    uint8_t i;
+
+    for (i = 0; i < MAX_TASKS; i++) {
+        if (_g_tasks[i] == task)
+            _g_tasks[i] = NULL;
+    }
+
+    task->line = 0;
+}
+
+bool task_running(task_t *task)
+{
+    uint8_t i;
+
+    for (i = 0; i < MAX_TASKS; i++) {
+        if (_g_tasks[i] == task)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * From the idle loop. Each task gets one step, up to its next wait, so
+ * a pass takes as long as the slowest step (one PSU's worth of I2C).
+ */
+void task_run(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < MAX_TASKS; i++) {
+        task_t *task = _g_tasks[i];
+
+        if (task && task->fn(task) == TASK_DONE)
+            _g_tasks[i] = NULL;
+    }
+}
+
+void task_set_deadline(task_t *task, uint32_t ms)
+{
+    // Rounded up, plus a tick as the current one is partly gone. Never short
+    task->until = get_tick_count() + (ms + TIMEOUT_MS_PER_TICK - 1) / TIMEOUT_MS_PER_TICK + 1;
+}
+
+bool task_expired(task_t *task)
+{
+    return tick_reached(get_tick_count(), task->until);
+}
@@ -0,0 +1,71 @@
+/*
+ *   File:   task.h
+ *   Author: agent
+ *
+ *   FNP600/850/1000 Adapter Board
+ *
+ *   Created on 16 October 2026, 21:04
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TASK_H__
+#define __TASK_H__
+
+#define MAX_TASKS           4
+
+#define TASK_WAITING        0
+#define TASK_DONE           1
+
+/*
+ * Protothread style. A task is a function the idle loop calls over and
+ * over, and each call carries on from where the last one waited. Locals
+ * don't survive a wait, so anything needed across one lives in a static
+ * or behind task->data. The macros are cases of one switch, so a task
+ * can't have a switch of its own around a wait.
+ */
+#define TASK_BEGIN(t)           switch ((t)->line) { case 0:
+#define TASK_END(t)             } (t)->line = 0; return TASK_DONE
+#define TASK_EXIT(t)            do { (t)->line = 0; return TASK_DONE; } while (0)
+
+#define TASK_WAIT_UNTIL(t, cond) \
+    do { (t)->line = __LINE__; case __LINE__: if (!(cond)) return TASK_WAITING; } while (0)
+
+// Back to the idle loop once, e.g. between slow steps of a loop
+#define TASK_YIELD(t) \
+    do { (t)->line = __LINE__; return TASK_WAITING; case __LINE__: ; } while (0)
+
+#define TASK_WAIT_MS(t, ms) \
+    do { task_set_deadline(t, ms); TASK_WAIT_UNTIL(t, task_expired(t)); } while (0)
+
+// Runs another task's function to completion from inside this one
+#define TASK_SPAWN(t, child, fn, arg) \
+    do { task_init(child, fn, arg); TASK_WAIT_UNTIL(t, (fn)(child) == TASK_DONE); } while (0)
+
+typedef struct task task_t;
+
+struct task {
+    uint16_t line;      // Where to carry on from. 0 is the top
+    uint32_t until;     // Tick count the current TASK_WAIT_MS ends at
+    uint8_t (*fn)(task_t *task);
+    void *data;
+};
+
+void task_init(task_t *task, uint8_t (*fn)(task_t *task), void *data);
+bool task_start(task_t *task, uint8_t (*fn)(task_t *task), void *data);
+void task_stop(task_t *task);
+bool task_running(task_t *task);
+void task_run(void);
+void task_set_deadline(task_t *task, uint32_t ms);
+bool task_expired(task_t *task);
+
+#endif /* __TASK_H__ */
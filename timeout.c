@@ -25,85 +25,196 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <avr/io.h>
 #include <avr/interrupt.h>
 
 #include "timeout.h"
+#include "latency.h"
 
 #define MAX_SOFT_TIMERS 10
+#define TIMER_NONE      0xFF
 
 #define F_ACTIVE        0x01
 #define F_RUNNING       0x02
 #define F_REPEAT        0x04
 
-#define MS(x) ((x) / TIMEOUT_MS_PER_TICK)
-
-#define TIMER1H_RELOAD  0xA6 /* Approx 100ms */
+/*
+ * Timer1 runs off F_CPU / 8, which is 1843.2 counts per ms. There's no
+ * whole number compare for 1 ms, so one period in five is a count longer.
+ * That's 9216 counts per 5 ms exactly, so the tick never drifts, only
+ * jitters by a count (0.54 us).
+ */
+#define TIMER1_PERIOD   1843
+#define TIMER1_LONG     5       // Every this many periods is one count longer
+#define US_PER_COUNT_16 35556   // 1000 / 1843.2 in 16.16 fixed point
 
 typedef struct
 {
     uint8_t flags;
-    int32_t next_fires;
+    uint8_t next;       // Next running timer, in firing order
+    uint32_t next_fires;
     uint32_t interval;
     void *data;
     void (*callback)(void *);
 } timeout_t;
 
 timeout_t _g_timers[MAX_SOFT_TIMERS];
-int32_t _g_tick_count;
+uint8_t _g_timer_head = TIMER_NONE; // Soonest running timer
+
+volatile uint32_t _g_tick_count;
+volatile uint32_t _g_uptime;
+static volatile uint16_t _g_tick_ms;  // Into the current second
+static volatile uint8_t _g_tick_phase;
+
+/*
+ * Copy of the head timer's next_fires so the ISR can spot it with one
+ * compare. The idle loop only ever looks at _g_timeout_due.
+ */
+static volatile uint32_t _g_next_fires;
+static volatile bool _g_timeout_due;
 
-ISR(TIMER1_OVF_vect)
+ISR(TIMER1_COMPA_vect)
 {
+    LATENCY_TICK();
+
     _g_tick_count++;
 
-    TCNT1H = TIMER1H_RELOAD;
-    TCNT1L = 0x00;
+    if (_g_tick_count == _g_next_fires)
+        _g_timeout_due = true;
+
+    // OCR1A isn't buffered in CTC mode. TCNT1 has only just restarted so
+    // the new value takes effect for this period. It counts OCR1A + 1
+    if (++_g_tick_phase == TIMER1_LONG)
+    {
+        _g_tick_phase = 0;
+        OCR1A = TIMER1_PERIOD;
+    }
+    else
+    {
+        OCR1A = TIMER1_PERIOD - 1;
+    }
+
+    if (++_g_tick_ms == 1000)
+    {
+        _g_tick_ms = 0;
+        _g_uptime++;
+    }
 }
 
 void timeout_init(void)
 {
     _g_tick_count = 0;
+    _g_uptime = 0;
+    _g_tick_ms = 0;
+    _g_tick_phase = 0;
+    _g_timer_head = TIMER_NONE;
+    _g_next_fires = (uint32_t)-1; // 49 days off. Nothing's running yet
+    _g_timeout_due = false;
     memset(&_g_timers, 0, sizeof(_g_timers));
 
+    // CTC mode, top is OCR1A. CLK(i/o) prescaler 8
     TCCR1A = 0x00;
-    // CLK(i/o) prescaler 64
-    TCCR1B &= ~(1 << CS12);
-    TCCR1B |= (1 << CS11);
-    TCCR1B |= (1 << CS10);
+    TCCR1B = (1 << WGM12) | (1 << CS11);
+    OCR1A = TIMER1_PERIOD - 1;
+    TCNT1 = 0;
 
-    TIMSK1 |= (1 << TOIE1);
+    TIMSK1 |= (1 << OCIE1A);
+}
 
-    TCNT1H = TIMER1H_RELOAD;
-    TCNT1L = 0x00;
+/*
+ * Call with interrupts off. The ISR raises _g_timeout_due when the tick
+ * count reaches _g_next_fires, so that has to be in the future or the flag
+ * set here already.
+ */
+static void timeout_rearm(void)
+{
+    if (_g_timer_head == TIMER_NONE)
+    {
+        _g_next_fires = _g_tick_count - 1;
+        _g_timeout_due = false;
+        return;
+    }
 
-    // Note to self: AVR Timers do not seem to have a 'go' bit
-    // They're always going...
+    _g_next_fires = _g_timers[_g_timer_head].next_fires;
+    _g_timeout_due = tick_reached(_g_tick_count, _g_next_fires);
+}
+
+static void timeout_unlink(uint8_t index)
+{
+    uint8_t *link = &_g_timer_head;
+
+    while (*link != TIMER_NONE)
+    {
+        if (*link == index)
+        {
+            *link = _g_timers[index].next;
+            break;
+        }
+        link = &_g_timers[*link].next;
+    }
+
+    _g_timers[index].flags &= ~F_RUNNING;
+}
+
+/*
+ * Equal deadlines keep the order they were started in.
+ */
+static void timeout_insert(uint8_t index)
+{
+    timeout_t *timer = &_g_timers[index];
+    uint8_t *link = &_g_timer_head;
+
+    while (*link != TIMER_NONE &&
+        tick_reached(timer->next_fires, _g_timers[*link].next_fires))
+    {
+        link = &_g_timers[*link].next;
+    }
+
+    timer->next = *link;
+    *link = index;
+    timer->flags |= F_RUNNING;
 }
 
 void timeout_check(void)
 {
-    uint8_t i;
+    uint32_t now;
+
+    if (!_g_timeout_due)
+        return;
 
-    for (i = 0; i < MAX_SOFT_TIMERS; i++)
+    now = get_tick_count();
+
+    // Anything started or restarted by a callback is due after now, so
+    // this stops once the timers due this tick have all had their go
+    while (_g_timer_head != TIMER_NONE &&
+        tick_reached(now, _g_timers[_g_timer_head].next_fires))
     {
+        uint8_t i = _g_timer_head;
         timeout_t *timer = &_g_timers[i];
 
-        if (timer->flags & F_ACTIVE && timer->flags & F_RUNNING)
+        _g_timer_head = timer->next;
+        timer->flags &= ~F_RUNNING;
+        timer->callback(timer->data);
+
+        // Unless the callback stopped, restarted or destroyed it
+        if ((timer->flags & (F_ACTIVE | F_RUNNING | F_REPEAT)) == (F_ACTIVE | F_REPEAT))
         {
-            bool timedout;
-
-            g_irq_disable();
-            timedout = _g_tick_count >= timer->next_fires;
-            g_irq_enable();
-
-            if (timedout)
-            {
-                timer->flags &= ~F_RUNNING;                
-                timer->callback(timer->data);
-                if (timer->flags & F_REPEAT)
-                    timeout_start(i);
-            }
+            // On the beat if it's not fallen behind, so the period doesn't
+            // creep by however late the idle loop got here
+            uint32_t ticks = get_tick_count();
+
+            timer->next_fires += timer->interval;
+
+            if (tick_reached(ticks, timer->next_fires))
+                timer->next_fires = ticks + timer->interval + 1;
+
+            timeout_insert(i);
         }
     }
+
+    g_irq_disable();
+    timeout_rearm();
+    g_irq_enable();
 }
 
 int8_t timeout_create(uint32_t interval, bool start, bool repeat, void (*callback)(void *), void *data)
@@ -116,7 +227,7 @@ int8_t timeout_create(uint32_t interval, bool start, bool repeat, void (*callbac
         if (!(_g_timers[timer_index].flags & F_ACTIVE))
         {
             timer = &_g_timers[timer_index];
-            timer->flags |= F_ACTIVE;
+            timer->flags = F_ACTIVE;
             break;
         }
     }
@@ -139,26 +250,134 @@ int8_t timeout_create(uint32_t interval, bool start, bool repeat, void (*callbac
 
 void timeout_destroy(int8_t index)
 {
-    timeout_t *timer = &_g_timers[index];
-    timer->flags &= ~F_ACTIVE;
+    timeout_stop(index);
+    _g_timers[index].flags = 0;
 }
 
 void timeout_start(int8_t index)
 {
     timeout_t *timer = &_g_timers[index];
+
+    if (timer->flags & F_RUNNING)
+        timeout_unlink(index);
+
+    // Plus one as the current tick is already partly gone. Short waits
+    // (e.g. PSU EEPROM writes) are never cut short.
+    timer->next_fires = get_tick_count() + timer->interval + 1;
+    timeout_insert(index);
+
     g_irq_disable();
-    timer->next_fires = _g_tick_count + MS(timer->interval);
+    timeout_rearm();
     g_irq_enable();
-    timer->flags |= F_RUNNING;
 }
 
 void timeout_stop(int8_t index)
 {
-    timeout_t *timer = &_g_timers[index];
-    timer->flags &= ~F_RUNNING;
+    if (!(_g_timers[index].flags & F_RUNNING))
+        return;
+
+    timeout_unlink(index);
+
+    g_irq_disable();
+    timeout_rearm();
+    g_irq_enable();
+}
+
+/*
+ * Safe with interrupts off, e.g. in i2c_process() or from the TWI ISR.
+ */
+uint32_t get_tick_count(void)
+{
+    uint8_t sreg = SREG;
+    uint32_t ticks;
+
+    g_irq_disable();
+    ticks = _g_tick_count;
+
+    if (sreg & _BV(SREG_I))
+        g_irq_enable();
+
+    return ticks;
+}
+
+/*
+ * Microseconds since boot, for timing code. Wraps every 71 minutes, so
+ * only differences mean anything. Safe with interrupts on or off.
+ */
+uint32_t get_us_count(void)
+{
+    uint8_t sreg = SREG;
+    uint32_t ms;
+    uint16_t count;
+
+    g_irq_disable();
+    ms = _g_tick_count;
+    count = TCNT1;
+
+    // Rolled over since interrupts went off, but the ISR hasn't run yet
+    if (TIFR1 & (1 << OCF1A) && count < TIMER1_PERIOD / 2)
+        ms++;
+
+    if (sreg & _BV(SREG_I))
+        g_irq_enable();
+
+    return ms * 1000 + (uint16_t)(((uint32_t)count * US_PER_COUNT_16) >> 16);
+}
+
+/*
+ * Cheaper than get_us_count() for profiling: the tick count in the top 20
+ * bits and TCNT1 in the bottom 12, no multiplies. Only differences mean
+ * anything; get_stamp_us() turns one into microseconds.
+ */
+uint32_t get_timer_stamp(void)
+{
+    uint8_t sreg = SREG;
+    uint32_t ms;
+    uint16_t count;
+
+    g_irq_disable();
+    ms = _g_tick_count;
+    count = TCNT1;
+
+    if (TIFR1 & (1 << OCF1A) && count < TIMER1_PERIOD / 2)
+        ms++;
+
+    if (sreg & _BV(SREG_I))
+        g_irq_enable();
+
+    return ms << 12 | count;
+}
+
+/*
+ * Microseconds from one stamp to another, up to the 17 minutes the stamps
+ * take to wrap.
+ */
+uint32_t get_stamp_us(uint32_t from, uint32_t to)
+{
+    uint32_t diff = to - from;
+    // The count part differs by less than a period either way, so adding
+    // half of 4096 first makes the shift round to the right tick count
+    uint32_t ticks = (diff + 2048) >> 12;
+    int16_t counts = (int16_t)(diff - (ticks << 12));
+
+    if (!ticks)
+        return (uint16_t)(((uint32_t)(uint16_t)counts * US_PER_COUNT_16) >> 16);
+
+    // 1843.2 counts a tick is 1000 us, so only the counts need scaling
+    return ticks * 1000 + (int32_t)counts * US_PER_COUNT_16 / 65536;
 }
 
-int32_t get_tick_count(void)
+/*
+ * Whole seconds since boot. Unlike the tick count this is good for 136
+ * years.
+ */
+uint32_t get_uptime(void)
 {
-    return _g_tick_count;
-}
\ No newline at end of file
+    uint32_t secs;
+
+    g_irq_disable();
+    secs = _g_uptime;
+    g_irq_enable();
+
+    return secs;
+}
@@ -27,6 +27,17 @@ int8_t timeout_create(uint32_t interval, bool start, bool reapeat, void (*callba
 void timeout_destroy(int8_t index);
 void timeout_start(int8_t index);
 void timeout_stop(int8_t index);
-int32_t get_tick_count(void);
+/*
+ * True once tick count now has reached deadline. Good across the wrap as
+ * long as the two are within 24 days of each other. The subtraction is
+ * unsigned, so it wraps rather than overflowing.
+ */
+#define tick_reached(now, deadline) ((int32_t)((uint32_t)(now) - (uint32_t)(deadline)) >= 0)
+
+uint32_t get_tick_count(void);
+uint32_t get_us_count(void);
+uint32_t get_timer_stamp(void);
+uint32_t get_stamp_us(uint32_t from, uint32_t to);
+uint32_t get_uptime(void);
 
 #endif /* __TIMEOUT_H__ */
\ No newline at end of file
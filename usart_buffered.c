@@ -27,8 +27,10 @@
 #include <avr/interrupt.h>
 
 #include "usart_buffered.h"
+#include "latency.h"
+#include "timeout.h"
 
-#define UART_TX_BUFFER_SIZE 64
+#define UART_TX_BUFFER_SIZE 128
 #define UART_RX_BUFFER_SIZE 64
 
 #ifdef _USART1_
@@ -44,6 +46,15 @@
 #error TX buffer size is not a power of 2
 #endif
 
+/* Software flow control. XOFF goes out at the high watermark, XON once
+ * the ring has drained to the low one. The host may still send a few
+ * bytes after XOFF, hence the headroom. */
+#define UART_RX_HIGH_WATER  (UART_RX_BUFFER_SIZE - 16)
+#define UART_RX_LOW_WATER   (UART_RX_BUFFER_SIZE / 4)
+
+#define XON                 0x11
+#define XOFF                0x13
+
 static volatile uint8_t _g_usart_txbuf[UART_TX_BUFFER_SIZE];
 static volatile uint8_t _g_usart_rxbuf[UART_RX_BUFFER_SIZE];
 static volatile uint8_t _g_usart_txhead;
@@ -51,6 +62,22 @@ static volatile uint8_t _g_usart_txtail;
 static volatile uint8_t _g_usart_rxhead;
 static volatile uint8_t _g_usart_rxtail;
 static volatile uint8_t _g_usart_last_rx_error;
+static volatile bool _g_usart_flow;
+static volatile bool _g_usart_rx_stopped;  // We sent XOFF
+static volatile bool _g_usart_tx_stopped;  // Host sent XOFF
+static volatile uint8_t _g_usart_tx_ctl;   // XON/XOFF to send ahead of the ring. 0 = none
+static volatile bool _g_usart_tx_sent;     // TXC0 is only meaningful once a byte has gone out
+static bool _g_usart_tx_stalled;           // usart1_put() gave up waiting. Drops until there's room
+static volatile usart_stats_t _g_usart_stats;
+
+/* Writing a one clears TXC0. FE0, DOR0 and UPE0 must be written as zero. */
+#define usart1_clear_txc()  (UCSR0A = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0))
+
+static void usart1_send_ctl(uint8_t c)
+{
+    _g_usart_tx_ctl = c;
+    UCSR0B |= _BV(UDRIE0);
+}
 
 ISR(USART_RX_vect)
 {
@@ -58,21 +85,45 @@ ISR(USART_RX_vect)
     uint8_t data;
     uint8_t usr;
     uint8_t lastRxError;
+    LATENCY_ISR(LATENCY_RX);
  
     usr  = UCSR0A;
     data = UDR0;
     
     lastRxError = (usr & (_BV(FE0) | _BV(DOR0)));
+
+    if (usr & _BV(FE0))
+        _g_usart_stats.rx_framing++;
+    if (usr & _BV(DOR0))
+        _g_usart_stats.rx_overruns++;
+
+    if (_g_usart_flow && (data == XON || data == XOFF))
+    {
+        _g_usart_tx_stopped = (data == XOFF);
+        if (!_g_usart_tx_stopped)
+            UCSR0B |= _BV(UDRIE0);
+        _g_usart_last_rx_error = lastRxError;
+        return;
+    }
+
     tmphead = (_g_usart_rxhead + 1) & UART_RX_BUFFER_MASK;
     
     if (tmphead == _g_usart_rxtail)
     {
-        lastRxError = UART_BUFFER_OVERFLOW >> 8;
+        lastRxError |= UART_BUFFER_OVERFLOW;
+        _g_usart_stats.rx_overflows++;
     }
     else
     {
         _g_usart_rxhead = tmphead;
         _g_usart_rxbuf[tmphead] = data;
+
+        if (_g_usart_flow && !_g_usart_rx_stopped &&
+                ((tmphead - _g_usart_rxtail) & UART_RX_BUFFER_MASK) >= UART_RX_HIGH_WATER)
+        {
+            _g_usart_rx_stopped = true;
+            usart1_send_ctl(XOFF);
+        }
     }
 
     _g_usart_last_rx_error = lastRxError;   
@@ -81,12 +132,26 @@ ISR(USART_RX_vect)
 ISR(USART_UDRE_vect)
 {
     uint8_t tmptail;
-    
-    if (_g_usart_txhead != _g_usart_txtail)
+    LATENCY_ISR(LATENCY_UDRE);
+
+    if (_g_usart_tx_ctl)
+    {
+        UDR0 = _g_usart_tx_ctl;
+        usart1_clear_txc();
+        _g_usart_tx_ctl = 0;
+        _g_usart_tx_sent = true;
+    }
+    else if (_g_usart_tx_stopped)
+    {
+        UCSR0B &= ~_BV(UDRIE0); // Re-enabled on XON
+    }
+    else if (_g_usart_txhead != _g_usart_txtail)
     {
         tmptail = (_g_usart_txtail + 1) & UART_TX_BUFFER_MASK;
         _g_usart_txtail = tmptail;
         UDR0 = _g_usart_txbuf[tmptail];
+        usart1_clear_txc();
+        _g_usart_tx_sent = true;
     }
     else
     {
@@ -100,6 +165,11 @@ void usart1_open(uint8_t flags, uint16_t brg)
     _g_usart_txtail = 0;
     _g_usart_rxhead = 0;
     _g_usart_rxtail = 0;
+    _g_usart_flow = false;
+    _g_usart_rx_stopped = false;
+    _g_usart_tx_stopped = false;
+    _g_usart_tx_ctl = 0;
+    _g_usart_tx_sent = false;
     
     UCSR0C |= _BV(UMSEL01);
 
@@ -161,25 +231,98 @@ char usart1_get(void)
     
     tmptail = (_g_usart_rxtail + 1) & UART_RX_BUFFER_MASK;
     _g_usart_rxtail = tmptail;
+
+    if (_g_usart_rx_stopped &&
+            ((_g_usart_rxhead - tmptail) & UART_RX_BUFFER_MASK) <= UART_RX_LOW_WATER)
+    {
+        _g_usart_rx_stopped = false;
+        usart1_send_ctl(XON);
+    }
     
     return _g_usart_rxbuf[tmptail];
 }
 
-void usart1_put(char c)
+bool usart1_try_put(char c)
 {
     uint8_t tmphead = (_g_usart_txhead + 1) & UART_TX_BUFFER_MASK;
-    
-    while (tmphead == _g_usart_txtail);
-    
+
+    if (tmphead == _g_usart_txtail)
+        return false;
+
     _g_usart_txbuf[tmphead] = c;
     _g_usart_txhead = tmphead;
 
     UCSR0B |= _BV(UDRIE0);
+    return true;
+}
+
+/*
+ * How long the TX ring takes to drain at the current rate, plus a margin.
+ * 10 bits per byte, 16 clocks per bit at UBRR + 1, ring plus ctl and UDR0.
+ */
+static uint32_t usart1_drain_ms(void)
+{
+    uint16_t brg = UBRR0L | ((uint16_t)UBRR0H << 8);
+
+    return (((uint32_t)(UART_TX_BUFFER_SIZE + 2) * 160UL *
+            (brg + 1)) / (F_CPU / 1000UL)) + 10;
 }
 
+/*
+ * Waits for room, but no longer than the ring takes to drain: past that
+ * the host is holding us off with XOFF, and everything else in the idle
+ * loop would stall with it. The byte is dropped and false returned, and
+ * later ones are dropped without waiting until the ring has room again.
+ */
+bool usart1_put(char c)
+{
+    uint32_t limit;
+    uint32_t start;
+
+    if (usart1_try_put(c))
+    {
+        _g_usart_tx_stalled = false;
+        return true;
+    }
+
+    if (_g_usart_tx_stalled)
+        return false;
+
+    limit = usart1_drain_ms();
+    start = get_tick_count();
+
+    while (!usart1_try_put(c))
+    {
+        CLRWDT(); // Bounded, well inside the watchdog period
+
+        if (get_tick_count() - start > limit)
+        {
+            _g_usart_tx_stalled = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint8_t usart1_tx_free(void)
+{
+    return (_g_usart_txtail - _g_usart_txhead - 1) & UART_TX_BUFFER_MASK;
+}
+
+/*
+ * Busy until the last stop bit has left the shift register. UDRE0 alone
+ * goes high while the final byte is still on the wire.
+ */
 bool usart1_busy(void)
 {
-    return (_g_usart_txhead != _g_usart_txtail || (UCSR0A & _BV(UDRE0)) == 0);
+    if (_g_usart_txhead != _g_usart_txtail || _g_usart_tx_ctl)
+        return true;
+
+    if ((UCSR0A & _BV(UDRE0)) == 0)
+        return true;
+
+    return (_g_usart_tx_sent && (UCSR0A & _BV(TXC0)) == 0);
 }
 
 uint8_t usart1_get_last_rx_error(void)
@@ -187,4 +330,76 @@ uint8_t usart1_get_last_rx_error(void)
     return _g_usart_last_rx_error;
 }
 
+/*
+ * Changes rate once everything queued has gone out at the old one. The
+ * wait is bounded by the time a full ring takes at the old rate, plus a
+ * margin: if the host is holding us off with XOFF it may never drain.
+ * Whatever is still queued by then is dropped, as it would only go out
+ * at the wrong rate, and a held XOFF is released so output resumes at
+ * the new one.
+ */
+void usart1_set_brg(uint16_t brg)
+{
+    uint32_t limit = usart1_drain_ms();
+    uint32_t start = get_tick_count();
+
+    while (usart1_busy())
+    {
+        CLRWDT();
+
+        if (get_tick_count() - start > limit)
+        {
+            g_irq_disable();
+            _g_usart_txtail = _g_usart_txhead;
+            _g_usart_tx_stopped = false;
+            g_irq_enable();
+            break;
+        }
+    }
+
+    UBRR0L = (brg & 0xFF);
+    UBRR0H = (brg >> 8);
+}
+
+/*
+ * XON/XOFF is handled in the ISRs, in both directions. Off for anything
+ * that isn't plain text. Turning it off releases both sides.
+ */
+void usart1_set_flow_control(bool enable)
+{
+    g_irq_disable();
+
+    _g_usart_flow = enable;
+
+    if (!enable)
+    {
+        if (_g_usart_rx_stopped)
+            usart1_send_ctl(XON);
+
+        _g_usart_rx_stopped = false;
+        _g_usart_tx_stopped = false;
+        UCSR0B |= _BV(UDRIE0);
+    }
+
+    g_irq_enable();
+}
+
+void usart1_get_stats(usart_stats_t *stats)
+{
+    g_irq_disable();
+    *stats = _g_usart_stats;
+    stats->rx_stopped = _g_usart_rx_stopped;
+    stats->tx_stopped = _g_usart_tx_stopped;
+    g_irq_enable();
+}
+
+void usart1_clear_stats(void)
+{
+    g_irq_disable();
+    _g_usart_stats.rx_overflows = 0;
+    _g_usart_stats.rx_overruns = 0;
+    _g_usart_stats.rx_framing = 0;
+    g_irq_enable();
+}
+
 #endif /* _USART1_ */
\ No newline at end of file
@@ -31,15 +31,29 @@
 
 #define UART_BUFFER_OVERFLOW  0x02
 
+typedef struct {
+    uint16_t rx_overflows;  // Lost to a full RX ring
+    uint16_t rx_overruns;   // Lost in the hardware before the ISR ran
+    uint16_t rx_framing;
+    bool rx_stopped;        // XOFF sent to the host
+    bool tx_stopped;        // XOFF received from the host
+} usart_stats_t;
+
 #ifdef _USART1_
 
 void usart1_open(uint8_t flags, uint16_t brg);
 bool usart1_busy(void);
-void usart1_put(char c);
+bool usart1_put(char c);
+bool usart1_try_put(char c);
+uint8_t usart1_tx_free(void);
 bool usart1_data_ready(void);
 char usart1_get(void);
 void usart1_clear_oerr(void);
 uint8_t usart1_get_last_rx_error(void);
+void usart1_set_brg(uint16_t brg);
+void usart1_set_flow_control(bool enable);
+void usart1_get_stats(usart_stats_t *stats);
+void usart1_clear_stats(void);
 
 #endif /* _USART1_ */
 
@@ -33,21 +33,98 @@
 #include "util.h"
 #include "usart_buffered.h"
 #include "config.h"
+#include "timeout.h"
+
+#define BENCH_CALLS     100
+
+#define POW10_NUM       9
+#define POW10_UNITS     7 // Index of 100, the whole units of a 2dp value
+
+static const uint32_t _g_pow10[POW10_NUM] PROGMEM = {
+    1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10
+};
+
+static uint8_t _g_console_policy;
+static bool _g_console_truncating;
+static uint16_t _g_console_dropped;
+static bool _g_console_muted;
 
 void reset(void)
 {
+    while (console1_busy()); // Let anything queued go out first
+
     /* Uses the watch dog timer to reset */
     wdt_enable(WDTO_15MS);
     while (1);
 }
 
+/*
+ * Output is queued in the TX ring and only waits when the ring is full,
+ * for no longer than it takes to drain (see usart1_put()). Under
+ * CONSOLE_TRUNCATE it doesn't wait at all: once a byte doesn't fit, the
+ * rest of that line is thrown away so whatever does go out is still
+ * whole lines.
+ */
 int print_char(char byte, FILE *stream)
 {
-    while (console1_busy());
-    console1_put(byte);
+    if (_g_console_muted)
+        return 0;
+
+    if (_g_console_policy == CONSOLE_BLOCK) {
+        if (!console1_put(byte))
+            _g_console_dropped++; // Held off by XOFF for too long
+        return 0;
+    }
+
+    if (_g_console_truncating && byte != '\r' && byte != '\n') {
+        _g_console_dropped++;
+        return 0;
+    }
+
+    if (console1_try_put(byte)) {
+        if (byte == '\n')
+            _g_console_truncating = false;
+    } else {
+        _g_console_truncating = true;
+        _g_console_dropped++;
+    }
+
     return 0;
 }
 
+/*
+ * Returns the previous policy so callers can put it back.
+ */
+uint8_t console_set_policy(uint8_t policy)
+{
+    uint8_t old = _g_console_policy;
+
+    _g_console_policy = policy;
+    return old;
+}
+
+/*
+ * For when something else owns the port (e.g. binary mode). Anything
+ * printed in the meantime is thrown away.
+ */
+void console_mute(bool mute)
+{
+    _g_console_muted = mute;
+}
+
+uint16_t console_get_dropped(void)
+{
+    return _g_console_dropped;
+}
+
+/*
+ * Only rates F_CPU divides into exactly: 9600 up to F_CPU / 16 (921600).
+ */
+bool uart_baud_valid(uint32_t baud)
+{
+    return (baud >= UART1_BAUD && baud <= F_CPU / 16 && (F_CPU / 16) % baud == 0);
+}
+
 void format_fixedpoint(char *buf, int16_t value, uint8_t type)
 {
     char sign[2];
@@ -65,13 +142,124 @@ void format_fixedpoint(char *buf, int16_t value, uint8_t type)
         sprintf(buf, "%s%u.%02u", sign, abs(value) / _2DP_BASE, abs(value) % _2DP_BASE);
 }
 
-void eeprom_write_data(uint8_t addr, uint8_t *bytes, uint8_t len)
+/*
+ * Hundredths as a decimal, e.g. 1234 -> "12.34", right aligned with spaces
+ * to width. Each digit is counted out by subtracting its power of ten, at
+ * most 9 times, so there's no divide (the AVR has no divider) and none of
+ * vfprintf. Once what's left fits in 16 bits the rest is done in 16 bits,
+ * which is all a single PSU's readings ever need. Not null terminated.
+ * Returns the number of chars written, at most FIXED_2DP_MAX.
+ */
+uint8_t format_2dp(char *buf, uint32_t value, uint8_t width)
+{
+    char *p = buf;
+    bool lead = true;
+    uint8_t i;
+
+    for (i = 0; i < POW10_NUM; i++) {
+        uint32_t pow = pgm_read_dword(&_g_pow10[i]);
+        char digit = '0';
+
+        if (value > 0xFFFF) {
+            while (value >= pow) {
+                value -= pow;
+                digit++;
+            }
+        } else if (value >= pow) {
+            uint16_t v16 = value;
+            uint16_t p16 = pow;
+
+            while (v16 >= p16) {
+                v16 -= p16;
+                digit++;
+            }
+
+            value = v16;
+        }
+
+        if (digit != '0' || i == POW10_UNITS) // Always "0.xx", never ".xx"
+            lead = false;
+
+        if (!lead)
+            *p++ = digit;
+        else if (FIXED_2DP_MAX - i <= width)
+            *p++ = ' ';
+
+        if (i == POW10_UNITS)
+            *p++ = '.';
+    }
+
+    *p++ = '0' + (uint8_t)value;
+
+    return p - buf;
+}
+
+/*
+ * As format_2dp() but to the console, through print_char() so the mute
+ * and truncate policies still apply.
+ */
+void print_2dp(uint32_t value, uint8_t width)
+{
+    char buf[FIXED_2DP_MAX];
+    uint8_t len = format_2dp(buf, value, width);
+    uint8_t i;
+
+    for (i = 0; i < len; i++)
+        putchar(buf[i]);
+}
+
+#ifdef _BENCHMARK_
+static uint16_t bench_sprintf(char *buf, uint16_t value)
+{
+    return sprintf(buf, "%u.%02u", fixedpoint_arg_u_2dp(value));
+}
+
+static uint16_t bench_fixed(char *buf, uint16_t value)
+{
+    return format_2dp(buf, value, 0);
+}
+
+/*
+ * Timed off the microsecond count. The 1 ms tick interrupt lands in both
+ * runs alike, as does the loop and call overhead.
+ */
+static uint16_t bench_run(uint16_t (*format)(char *, uint16_t))
+{
+    char buf[FIXED_2DP_MAX + 1];
+    uint32_t start;
+    uint32_t elapsed;
+    uint8_t i;
+
+    start = get_us_count();
+
+    for (i = 0; i < BENCH_CALLS; i++)
+        format(buf, OUTPUT_VOLTAGE_MAX - i * 11); // A spread of typical readings
+
+    elapsed = get_us_count() - start;
+
+    return elapsed * (F_CPU / 1000) / 1000 / BENCH_CALLS;
+}
+
+void format_benchmark(void)
+{
+    uint16_t old = bench_run(&bench_sprintf);
+    uint16_t fixed = bench_run(&bench_fixed);
+
+    printf("Cycles per call, %u calls each\r\n", BENCH_CALLS);
+    printf("sprintf \"%%u.%%02u\" : %u\r\n", old);
+    printf("format_2dp       : %u\r\n", fixed);
+    printf("Saved            : %u (%u us)\r\n",
+        old - fixed, (uint16_t)((uint32_t)(old - fixed) * 1000 / (F_CPU / 1000)));
+}
+#endif /* _BENCHMARK_ */
+
+void eeprom_write_data(uint16_t addr, uint8_t *bytes, uint8_t len)
 {
     uint16_t dest = addr;
     eeprom_update_block(bytes, (void *)dest, len);
 }
 
-void eeprom_read_data(uint8_t addr, uint8_t *bytes, uint8_t len)
+void eeprom_read_data(uint16_t addr, uint8_t *bytes, uint8_t len)
 {
     uint16_t dest = addr;
     eeprom_read_block(bytes, (void *)dest, len);
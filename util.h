@@ -23,9 +23,18 @@
 
 
 void reset(void);
-void eeprom_read_data(uint8_t addr, uint8_t *bytes, uint8_t len);
-void eeprom_write_data(uint8_t addr, uint8_t *bytes, uint8_t len);
+void eeprom_read_data(uint16_t addr, uint8_t *bytes, uint8_t len);
+void eeprom_write_data(uint16_t addr, uint8_t *bytes, uint8_t len);
 int print_char(char byte, FILE *stream);
+uint8_t console_set_policy(uint8_t policy);
+void console_mute(bool mute);
+uint16_t console_get_dropped(void);
+bool uart_baud_valid(uint32_t baud);
+uint8_t format_2dp(char *buf, uint32_t value, uint8_t width);
+void print_2dp(uint32_t value, uint8_t width);
+#ifdef _BENCHMARK_
+void format_benchmark(void);
+#endif /* _BENCHMARK_ */
 
 #undef printf
 #define printf(fmt, ...) printf_P(PSTR(fmt) __VA_OPT__(,) __VA_ARGS__)
@@ -36,9 +45,14 @@ int print_char(char byte, FILE *stream);
 #define stricmp_p(str, to) strcasecmp_P(str, PSTR(to))
 #define stricmp strcasecmp
 
+#define CONSOLE_BLOCK      0 // Wait for room in the TX ring
+#define CONSOLE_TRUNCATE   1 // Cut lines short rather than wait
+
 #define _1DP_BASE 10
 #define _2DP_BASE 100
 
+#define FIXED_2DP_MAX       11 // "42949672.95"
+
 #define I_1DP               0
 #define I_2DP               1
 #define U_1DP               4